@@ -64,12 +64,6 @@ size_t sizes[NALLOCATORS] = {
     128, 256, 512, 1024, 2048, 4096, 8192, 16384, 32768, 65536
 };
 
-void m61_print_hh_report();
-
-unsigned long long alloc_size[NALLOCATORS];
-int line[NALLOCATORS];
-unsigned long long total_size;
-
 static void phase(double skew, unsigned long long count) {
     // Calculate the probability we'll call allocator I.
     // That probability equals  2^(-I*skew) / \sum_{i=0}^40 2^(-I*skew).
@@ -78,7 +72,6 @@ static void phase(double skew, unsigned long long count) {
     //   which is called twice as often as the third, and so forth.
     // When skew=-1, the first allocator is called HALF as often as the second,
     //   which is called HALF as often as the third, and so forth.
-    unsigned long long size;
     double sum_p = 0;
     for (int i = 0; i < NALLOCATORS; ++i)
         sum_p += pow(0.5, i * skew);
@@ -92,9 +85,6 @@ static void phase(double skew, unsigned long long count) {
     // (limit[i] - limit[i-1]) / (double) RAND_MAX,
     // if we pretend that limit[-1] == 0.
 
-    total_size = 0;
-    memset(alloc_size, 0, sizeof(alloc_size));
-
     int progress = 0;
     // Pick `count` random allocators and call them.
     unsigned long long i = 0;
@@ -105,12 +95,6 @@ static void phase(double skew, unsigned long long count) {
             ++r;
         allocators[r](sizes[r]);
 
-        size = sizes[r];
-
-        alloc_size[r] += size;
-        total_size += size;
-        line[r] = r+10;
-
         if (((double)i)/count > 0.25 && progress == 0){
             printf ("25%%\n");
             progress = 25;
@@ -160,14 +144,3 @@ int main(int argc, char **argv) {
 
     m61_print_hh_report();
 }
-
-void m61_print_hh_report(){
-    float sizerate;
-    
-    for(int i = 0; i < NALLOCATORS; i++)
-    {   
-        sizerate = 100.0 * alloc_size[i] / total_size;
-        if(sizerate >= 10)
-            printf("HEAVY HITTER: hhtest.c:%d: %lld bytes (~%.1f%%)\n", line[i], alloc_size[i], sizerate);
-    }
-}
\ No newline at end of file
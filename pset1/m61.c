@@ -6,89 +6,2520 @@
  * HID: 20787139
  */
 #define M61_DISABLE 1
+#define _GNU_SOURCE
 #include "m61.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <time.h>
 
-/* Statistics about the memory allocator */
-struct m61_statistics stats;
+#if M61_PRELOAD
+/* In libm61.so, malloc and friends are m61 itself (see m61preload.c), so
+ * the tables of m61 come straight from the C library's allocator */
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nmemb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+#define malloc(sz)              __libc_malloc(sz)
+#define calloc(nmemb, sz)       __libc_calloc((nmemb), (sz))
+#define realloc(ptr, sz)        __libc_realloc((ptr), (sz))
+#define free(ptr)               __libc_free(ptr)
+#endif
+
+/* Lowest and highest addresses handed out by any thread (updated with CAS) */
+char* heap_min = NULL;
+char* heap_max = NULL;
+
+/* Protects the node list and node index. Recursive, because the public
+ * lookup helpers lock it and are also called from m61_free. Only taken
+ * when allocations are tracked with nodes; slab operations never take it.
+ */
+pthread_mutex_t meta_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* Mean number of bytes between sampled allocations; 0 tracks every allocation.
+ * Set with m61_set_sample_rate or the M61_SAMPLE_RATE environment variable.
+ */
+size_t sample_rate = 0;
 
 /* Head of m61_node's list 
  * 
  * This list contains metadata about blocks of memory used by the allocator,
  * such as block size, pointer and status
  */
-struct m61_node * head = NULL;
+struct m61_node * head = NULL;
+
+/* Tail of m61_node's list, so appending a node does not walk the list */
+struct m61_node * tail = NULL;
+
+/* Hash table keyed by address
+ *
+ * Open addressing with linear probing. The node index maps each block
+ * pointer to the most recent node allocated at that address, so lookups in
+ * m61_free and m61_realloc cost O(1) regardless of how many nodes the list
+ * holds.
+ */
+struct m61_hashtable {
+    void** keys;                        // addresses (NULL = empty slot)
+    void** values;                      // value for each key
+    size_t capacity;                    // number of slots (power of 2)
+    size_t size;                        // number of used slots
+};
+
+struct m61_hashtable node_index = { NULL, NULL, 0, 0 };
+
+static void m61_hash_insert(struct m61_hashtable* table, void* ptr, void* value);
+static void* m61_hash_find(struct m61_hashtable* table, void* ptr);
+static void m61_hash_remove(struct m61_hashtable* table, void* ptr);
+
+/* Address-ordered AVL tree of intervals
+ *
+ * Finds the interval containing an address with one predecessor search, in
+ * O(log n). The node tree holds the block of every node (live or
+ * quarantined) and backs interior-pointer diagnostics; the region tree holds
+ * every mapping or native block the allocator owns and backs
+ * m61_check_pointer_in_heap. Entries are recycled through a per-tree pool.
+ */
+struct m61_interval {
+    char* start;                        // first byte of the interval (key)
+    size_t size;                        // length in bytes
+    void* value;                        // node of the block (node tree only)
+    struct m61_interval * left;         // intervals starting lower
+    struct m61_interval * right;        // intervals starting higher
+    int height;                         // height of the subtree
+};
+
+struct m61_tree {
+    struct m61_interval * root;
+    struct m61_interval * pool;         // recycled entries, linked through right
+};
+
+/* Blocks of the nodes, protected by meta_lock */
+struct m61_tree node_tree = { NULL, NULL };
+
+/* Page-ownership bitmap
+ *
+ * Two levels over the address space (48 bits of user space on 64-bit
+ * targets, all 32 bits otherwise): page_map has one entry per
+ * M61_PAGE_LEAF_SHIFT-sized span, pointing to a leaf (mapped on first use,
+ * never released) with two bits per page. An owned page belongs entirely
+ * to a chunk or mapping of m61; a shared page holds part of a native
+ * block next to memory of the native allocator, so region_tree decides.
+ * Bits are set and cleared atomically; readers take no lock.
+ *
+ * Leaves also hold the shadow bitmap, one bit per M61_ALIGNMENT-byte
+ * granule, set while a live block starts there. m61_free tests and clears
+ * it in one atomic step, before reading any metadata. Only pages of the
+ * shadow bitmap that cover blocks are ever touched.
+ */
+struct m61_page_leaf {
+    unsigned long owned[M61_PAGE_LEAF_WORDS];
+    unsigned long shared[M61_PAGE_LEAF_WORDS];
+#if M61_CHECKS
+    unsigned long starts[M61_SHADOW_LEAF_WORDS];    // one bit per granule: start of a live block
+#endif
+};
+
+#if UINTPTR_MAX > 0xffffffffu
+#define M61_ADDRESS_BITS 48             /* Address bits covered by page_map */
+#else
+#define M61_ADDRESS_BITS 32
+#endif
+
+struct m61_page_leaf * page_map[(size_t) 1 << (M61_ADDRESS_BITS - M61_PAGE_LEAF_SHIFT)];
+
+/* Native blocks, the only regions not aligned to pages. Lock order: meta_lock first. */
+struct m61_tree region_tree = { NULL, NULL };
+pthread_rwlock_t region_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+struct m61_heap;
+
+static void m61_tree_insert(struct m61_tree* tree, void* start, size_t size, void* value);
+static void m61_tree_remove(struct m61_tree* tree, void* start);
+static struct m61_interval * m61_tree_floor(struct m61_tree* tree, void* ptr);
+static void m61_region_add(void* start, size_t size);
+static void m61_region_remove(void* start, size_t size);
+static void m61_pool_release(struct m61_heap* heap, struct m61_header* header);
+static void m61_shadow_set(void* ptr);
+static int m61_shadow_test(void* ptr);
+static int m61_shadow_test_and_clear(void* ptr);
+static void m61_shadow_clear_range(void* start, size_t size);
+static void m61_leak_site_add(struct m61_node* node, int sign);
+
+/* Guard-page mode
+ *
+ * When enabled (m61_set_guard_pages or M61_GUARD=1), every large block gets
+ * its own mapping with the data right-aligned against a PROT_NONE page, and
+ * slab slots are carved in runs of pages, each followed by a guard page, with
+ * the last slot of a run ending at its guard. Overrunning into a guard page
+ * faults at once; the fault handler finds the block through guard_index,
+ * which maps each guard page to the header of the block in front of it.
+ */
+int guard_pages = FALSE;
+struct m61_hashtable guard_index = { NULL, NULL, 0, 0 };
+size_t page_size = 4096;
+
+#define M61_HASH_MIN_CAPACITY 1024      /* Initial number of slots in the node index */
+
+/* Stack table
+ *
+ * Call stacks captured for tracked allocations are hash-consed: each
+ * distinct stack is stored once in stacks[], and nodes keep its id (index
+ * + 1). stack_slots is an open-addressing index of ids by stack hash.
+ * Capture is off until m61_set_stack_depth or M61_STACKS=<depth> turns it
+ * on. Protected by meta_lock.
+ */
+struct m61_stack {
+    unsigned hash;                      // hash of the frames
+    int depth;                          // number of frames
+    void* frames[M61_STACK_DEPTH];      // return addresses, innermost first
+};
+
+int stack_depth = 0;                    // frames captured per allocation (0 = off)
+struct m61_stack * stacks = NULL;
+size_t nstacks = 0;
+size_t stacks_capacity = 0;
+unsigned* stack_slots = NULL;
+size_t stack_slots_capacity = 0;
+
+/* Leak sites
+ *
+ * The live tracked blocks of each allocation site, kept up to date as
+ * nodes are allocated and freed, so that the leak report by site costs
+ * O(live sites) instead of a walk over every node. Open addressing on
+ * (file, line), grown by doubling; entries are never removed, but the
+ * sites with live blocks are also kept in a dense array, which is all the
+ * report reads. With a top-K set
+ * (m61_set_leak_report_sites or M61_LEAK_SITES=K), m61_printleakreport
+ * prints the K sites with the most bytes instead of one line per object.
+ * Protected by meta_lock.
+ */
+struct m61_leak_site {
+    const char* file;                   // file name of the site (NULL = free slot)
+    int line;                           // line number of the site
+    size_t count;                       // live tracked blocks
+    double nobjects;                    // allocations they stand for (weighted when sampling)
+    double nbytes;                      // bytes they stand for
+    size_t live;                        // position in live_sites while count != 0
+};
+
+#define M61_LEAK_SITES_MIN_CAPACITY 256 /* Initial number of slots in the leak site index */
+
+struct m61_leak_site * leak_sites = NULL;
+size_t leak_sites_count = 0;
+size_t leak_sites_capacity = 0;
+struct m61_leak_site ** live_sites = NULL;      // sites with live blocks, in no order
+size_t live_sites_count = 0;
+size_t live_sites_capacity = 0;
+size_t leak_report_sites = 0;           // sites printed by the leak report (0 = one line per object)
+
+/* Site histograms (m61_set_site_histograms or M61_HISTOGRAMS=1)
+ *
+ * Each heap counts the allocations and frees of its thread in its own site
+ * table, without locks; m61_print_site_histograms merges the tables.
+ * alloc_seq numbers allocations while histograms are on.
+ */
+int site_histograms = FALSE;
+unsigned long long alloc_seq = 0;
+
+/* Footprint section of m61_printstatistics (m61_set_footprint_report or
+ * M61_FOOTPRINT=1). Its counters are kept whether or not it is printed.
+ */
+int footprint_report = FALSE;
+
+/* Event trace
+ *
+ * When M61_TRACE=<file> is set (or m61_set_trace_file is called), every
+ * allocation, in-place resize and free is appended to a ring of
+ * fixed-size records in an mmap'd file. Threads claim slots with an
+ * atomic counter, so tracing never takes a lock. m61replay reads the file.
+ */
+struct m61_trace_header * trace = NULL;
+struct m61_trace_record * trace_records = NULL;
+unsigned long long trace_epoch = 0;     // CLOCK_MONOTONIC nanoseconds when the trace started
+
+/* Statistics segment (m61_set_shm_export or M61_SHM=1)
+ *
+ * Counters and hot sites are published to "/m61.<pid>" at most every
+ * M61_SHM_INTERVAL, by whichever thread notices on its allocation path
+ * that the segment is due; shm_writing keeps other writers out.
+ */
+struct m61_shm * shm = NULL;
+int shm_writing = FALSE;
+char shm_name[32];
+
+static void m61_shm_publish(void);
+
+/* Recycled nodes, linked through next. Nodes are carved M61_NODE_BATCH at
+ * a time from mmap'd memory and never given back to the system. */
+struct m61_node * node_pool = NULL;
+
+/* Quarantine of freed tracked blocks
+ *
+ * A FIFO ring of the nodes of the most recently freed blocks. Their memory
+ * is not reused while they stay here, so a double or invalid free of one of
+ * them is diagnosed from its node. The oldest entry is evicted when the ring
+ * is full or holds more than M61_QUARANTINE_BYTES: its node leaves the list
+ * and the index and goes back to the pool, and its memory is released.
+ */
+struct m61_node * quarantine[M61_QUARANTINE_SIZE];
+size_t quarantine_first = 0;            // index of the oldest entry
+size_t quarantine_count = 0;            // number of entries
+size_t quarantine_bytes = 0;            // bytes held by the entries
+
+/* Slab chunk
+ *
+ * A chunk is an M61_CHUNK_SIZE-aligned mmap'd region dedicated to one size
+ * class. This struct lives in its first M61_CHUNK_HEADER_SIZE bytes; slots
+ * are carved after it with a bump pointer and recycled through free lists.
+ */
+struct m61_chunk {
+    struct m61_heap * owner;            // heap whose free lists receive the slots
+    int sclass;                         // size class of every slot in the chunk
+    char* bump;                         // first slot never handed out
+    char* end;                          // end of the carvable area
+    char* run_end;                      // guard page closing the current run (guarded chunks)
+    int guarded;                        // TRUE if slots are carved in guarded runs
+    struct m61_chunk * next;            // next chunk in the heap
+};
+
+/* Space-Saving counter for one allocation site */
+struct m61_hh_counter {
+    const char* file;                   // file name of the site
+    int line;                           // line number of the site
+    int heap_pos;                       // position of the counter in the min-heap
+    unsigned long long count;           // estimated weight (never below the true weight)
+    unsigned long long error;           // maximum overestimation of count
+};
+
+/* Space-Saving sketch over allocation sites
+ *
+ * Fixed memory: M61_HH_COUNTERS counters kept in a min-heap by count, plus
+ * an open-addressing index from site to counter. An untracked site takes
+ * over the minimum counter and inherits its count as error, so every site
+ * weighing more than total / M61_HH_COUNTERS is guaranteed to be present.
+ * An update costs O(log M61_HH_COUNTERS), independent of the stream length.
+ */
+struct m61_hh_sketch {
+    struct m61_hh_counter counters[M61_HH_COUNTERS];
+    unsigned char heap[M61_HH_COUNTERS];        // counter ids ordered as a min-heap
+    unsigned char index[M61_HH_INDEX_SIZE];     // counter id + 1 per slot (0 = empty)
+    int ncounters;                              // counters in use
+    unsigned long long total;                   // total weight recorded
+};
+
+/* Size and lifetime histograms of one allocation site
+ *
+ * Bucket i of a histogram counts values v with m61_hist_bucket(v) == i:
+ * 0, 1, 2-3, 4-7, ... Lifetimes are measured in allocations, from the
+ * sequence number of the allocation to the one current at its free.
+ */
+struct m61_site {
+    const char* file;                   // file name of the site (NULL = free slot)
+    int line;                           // line number of the site
+    unsigned long long nallocs;         // allocations at the site
+    unsigned long long nbytes;          // bytes allocated at the site
+    unsigned long long nfrees;          // frees of blocks allocated at the site
+    unsigned long long size_hist[M61_HIST_BUCKETS];
+    unsigned long long lifetime_hist[M61_HIST_BUCKETS];
+};
+
+/* Free slots of one pool cached by a thread, so that it allocates and
+ * frees pool objects without locking */
+struct m61_pool_cache {
+    struct m61_pool * pool;             // pool of the slots (NULL = unused)
+    char* free;                         // free slots, linked through m61_pool_slot.next
+    size_t count;                       // slots in free
+};
+
+/* Per-thread slab heap
+ *
+ * Each thread allocates from its own heap without locking: the free lists
+ * cache the slots it recently freed, and its statistics shard is written
+ * only by the owner. A slot freed by another thread is pushed onto the
+ * owner's lock-free return queue and drained by the owner on its next miss.
+ * When a thread exits its heap is abandoned and adopted by the next new thread.
+ */
+struct m61_heap {
+    void* free[M61_NCLASSES];           // freed slots, linked through their data area
+    struct m61_chunk * current[M61_NCLASSES];  // chunk being carved for each class
+    struct m61_chunk * chunks;          // every chunk owned by the heap
+    struct m61_statistics stats;        // counter shard, merged by m61_getstatistics
+    struct m61_hh_sketch hh_bytes;      // heavy-hitter sites by bytes allocated
+    struct m61_hh_sketch hh_count;      // heavy-hitter sites by number of allocations
+    void* remote;                       // slots freed by other threads (Treiber stack)
+    struct m61_pool_cache pool_caches[M61_POOL_CACHES];    // free slots of the pools the thread uses
+    unsigned long long class_slots[M61_NCLASSES];   // slots in use (allocated or quarantined) per class
+    unsigned long long class_bytes[M61_NCLASSES];   // bytes requested by the slots in use
+    unsigned long long class_carved[M61_NCLASSES];  // bytes of slots ever carved from chunks
+    struct m61_site * sites;            // M61_SITES site histograms, mapped on first use
+    long long bytes_until_sample;       // bytes left before the next sampled allocation
+    unsigned long long random;          // xorshift state for sampling intervals
+    int abandoned;                      // TRUE once the owner thread exited
+    struct m61_heap * next;             // next heap in the registry
+};
+
+/* Chunk of an arena, mapped on its own; blocks are carved after this header */
+struct m61_arena_chunk {
+    struct m61_arena_chunk * prev;      // chunk mapped before this one
+    size_t size;                        // bytes mapped, header included
+};
+
+/* Arena: a bump allocator over a chain of chunks, released all together */
+struct m61_arena {
+    struct m61_arena_chunk * chunk;     // chunk being carved (the newest)
+    char* bump;                         // next free byte in chunk
+    char* end;                          // end of chunk
+    size_t active;                      // bytes allocated and not rewound
+};
+
+/* Chunk of a pool, mapped on its own; slots start M61_CACHE_LINE bytes in */
+struct m61_pool_chunk {
+    struct m61_pool_chunk * next;       // chunk mapped before this one
+    size_t size;                        // bytes mapped, header included
+};
+
+/* Pool of fixed-size objects, shared by threads. Each slot holds a
+ * struct m61_pool_slot and a block header, then the object, which starts
+ * on a cache line, and its verification chars.
+ *
+ * Threads allocate from and free to a cache of free slots kept in their
+ * heap, without locking. An empty cache is refilled from the slots other
+ * threads returned (taken all at once, like a heap's remote frees), else
+ * by carving a batch of slots under the pool's lock; a full cache returns
+ * freed slots to the pool's Treiber stack.
+ */
+struct m61_pool {
+    pthread_mutex_t lock;               // protects chunk carving (the fields below remote)
+    size_t object_size;                 // bytes of each object
+    size_t slot_size;                   // distance between slots, a multiple of M61_CACHE_LINE
+    char* remote;                       // free slots returned by threads (Treiber stack)
+    char* bump;                         // next never-used slot of the newest chunk
+    char* end;                          // end of the newest chunk
+    struct m61_pool_chunk * chunks;     // every chunk, newest first
+};
+
+/* Start of every pool slot. The block header follows, and stays intact
+ * while the slot is free, so a second free is still diagnosed */
+struct m61_pool_slot {
+    struct m61_pool * pool;             // pool owning the slot
+    char* next;                         // next free slot
+};
+
+/* Taken to hand a thread's cache over to another pool, and by
+ * m61_pool_destroy to drop the caches of its pool, so that a cache is
+ * never flushed into a destroyed pool */
+pthread_mutex_t pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Offset of the object in a pool slot */
+#define M61_POOL_DATA_OFFSET ((sizeof(struct m61_pool_slot) + M61_HEADER_SIZE + M61_CACHE_LINE - 1) & ~(size_t) (M61_CACHE_LINE - 1))
+
+/* Arena that malloc uses in the calling thread, or NULL for the heap */
+static __thread struct m61_arena * current_arena = NULL;
+
+/* Registry of every heap ever created; heaps are never removed */
+struct m61_heap * heaps = NULL;
+
+/* Heap of the calling thread */
+static __thread struct m61_heap * my_heap = NULL;
+
+static pthread_key_t heap_key;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Thread-exit destructor: hands the heap over to a future thread.
+ *
+ * @param heap - heap of the exiting thread
+ */
+static void m61_heap_release(void* heap){
+    my_heap = NULL;
+    __atomic_store_n(&((struct m61_heap*) heap)->abandoned, TRUE, __ATOMIC_RELEASE);
+}
+
+/**
+ * One-time initialization, run by the first allocation of the process:
+ * creates the heap key and reads the configuration from the environment.
+ */
+static void m61_init(void){
+    pthread_key_create(&heap_key, m61_heap_release);
+    page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+    const char* rate = getenv("M61_SAMPLE_RATE");
+    if (rate != NULL){
+        m61_set_sample_rate(strtoul(rate, NULL, 0));
+    }
+    const char* depth = getenv("M61_STACKS");
+    if (depth != NULL){
+        m61_set_stack_depth(atoi(depth));
+    }
+    const char* trace_file = getenv("M61_TRACE");
+    if (trace_file != NULL){
+        const char* records = getenv("M61_TRACE_RECORDS");
+        m61_set_trace_file(trace_file, records != NULL ? strtoul(records, NULL, 0) : M61_TRACE_RECORDS);
+    }
+    const char* histograms = getenv("M61_HISTOGRAMS");
+    if (histograms != NULL && atoi(histograms) != 0){
+        m61_set_site_histograms(TRUE);
+    }
+    const char* export = getenv("M61_SHM");
+    if (export != NULL && atoi(export) != 0){
+        m61_set_shm_export(TRUE);
+    }
+    const char* footprint = getenv("M61_FOOTPRINT");
+    if (footprint != NULL && atoi(footprint) != 0){
+        m61_set_footprint_report(TRUE);
+    }
+    const char* leak_sites = getenv("M61_LEAK_SITES");
+    if (leak_sites != NULL){
+        m61_set_leak_report_sites(strtoul(leak_sites, NULL, 0));
+    }
+    const char* guard = getenv("M61_GUARD");
+    if (guard != NULL && atoi(guard) != 0){
+        m61_set_guard_pages(TRUE);
+    }
+}
+
+/**
+ * Returns the calling thread's heap, adopting an abandoned heap or
+ * creating one on first use.
+ *
+ * @return heap - heap of the calling thread
+ */
+static struct m61_heap * m61_get_heap(void){
+    if (my_heap != NULL){
+        return my_heap;
+    }
+    pthread_once(&init_once, m61_init);
+
+    struct m61_heap * heap;
+    for (heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        int abandoned = TRUE;
+        if (__atomic_load_n(&heap->abandoned, __ATOMIC_RELAXED)
+            && __atomic_compare_exchange_n(&heap->abandoned, &abandoned, FALSE, 0,
+                                           __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)){
+            break;
+        }
+    }
+
+    if (heap == NULL){
+        heap = mmap(NULL, sizeof(struct m61_heap), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(heap != MAP_FAILED);
+        heap->next = __atomic_load_n(&heaps, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&heaps, &heap->next, heap, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+        }
+    }
+
+    pthread_setspecific(heap_key, heap);
+    my_heap = heap;
+    return heap;
+}
+
+/**
+ * Adds to a counter of the calling thread's shard. Only the owner writes
+ * a shard, so a relaxed store suffices for concurrent readers.
+ *
+ * @param counter - counter in the shard
+ * @param delta - value added (wraps around for decrements)
+ */
+static inline void m61_counter_add(unsigned long long* counter, unsigned long long delta){
+#if M61_STATS
+    __atomic_store_n(counter, *counter + delta, __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * Widens the [heap_min, heap_max] envelope to include a block.
+ *
+ * @param start - first byte of the block
+ * @param end - one past the last byte of the block
+ */
+static void m61_update_heap_range(char* start, char* end){
+    char* current = __atomic_load_n(&heap_min, __ATOMIC_RELAXED);
+    while ((current == NULL || current > start)
+           && !__atomic_compare_exchange_n(&heap_min, &current, start, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    }
+    current = __atomic_load_n(&heap_max, __ATOMIC_RELAXED);
+    while ((current == NULL || current < end)
+           && !__atomic_compare_exchange_n(&heap_max, &current, end, 1,
+                                           __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    }
+}
+
+/**
+ * Returns the slot size of a size class. Classes are 16-byte steps up to
+ * 128 bytes, then four classes per power of two up to M61_MAX_SMALL.
+ *
+ * @param sclass - size class index
+ * @return size - slot size in bytes
+ */
+static size_t m61_class_size(int sclass){
+    if (sclass < 8){
+        return (size_t) (sclass + 1) * 16;
+    }
+    int lg = 7 + (sclass - 8) / 4;
+    return ((size_t) 1 << lg) + (size_t) ((sclass - 8) % 4 + 1) * ((size_t) 1 << (lg - 2));
+}
+
+/**
+ * Returns the smallest size class whose slots fit a block.
+ *
+ * @param size - block size (header + data + verification chars)
+ * @return sclass - size class index, or M61_CLASS_LARGE if no class fits
+ */
+static int m61_size_class(size_t size){
+    if (size <= 128){
+        return size ? (int) (size - 1) / 16 : 0;
+    }
+    if (size > M61_MAX_SMALL){
+        return M61_CLASS_LARGE;
+    }
+    int lg = (int) (sizeof(unsigned long) * 8 - 1) - __builtin_clzl((unsigned long) (size - 1));
+    return 8 + (lg - 7) * 4 + (int) ((size - 1 - ((size_t) 1 << lg)) >> (lg - 2));
+}
+
+/**
+ * Maps a new chunk for a size class, aligned to M61_CHUNK_SIZE so the
+ * chunk of any slot can be found by masking its address.
+ *
+ * @param heap - heap that will own the chunk
+ * @param sclass - size class index
+ * @return chunk - new chunk, or NULL if the OS refused the mapping
+ */
+static struct m61_chunk * m61_chunk_create(struct m61_heap* heap, int sclass){
+    //Over-allocates by one chunk, then trims the misaligned ends
+    char* region = mmap(NULL, 2 * M61_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED){
+        return NULL;
+    }
+    char* start = (char*) (((uintptr_t) region + M61_CHUNK_SIZE - 1) & ~(uintptr_t) (M61_CHUNK_SIZE - 1));
+    if (start > region){
+        munmap(region, start - region);
+    }
+    munmap(start + M61_CHUNK_SIZE, region + M61_CHUNK_SIZE - start);
+
+    struct m61_chunk * chunk = (struct m61_chunk*) start;
+    chunk->owner = heap;
+    chunk->sclass = sclass;
+    chunk->bump = start + M61_CHUNK_HEADER_SIZE;
+    chunk->end = start + M61_CHUNK_SIZE;
+    chunk->run_end = NULL;
+    chunk->guarded = __atomic_load_n(&guard_pages, __ATOMIC_RELAXED);
+    chunk->next = heap->chunks;
+    heap->chunks = chunk;
+    m61_region_add(start, M61_CHUNK_SIZE);
+    return chunk;
+}
+
+/**
+ * Returns the chunk containing a slot.
+ *
+ * @param slot - any address inside a slab chunk
+ * @return chunk - chunk header
+ */
+static inline struct m61_chunk * m61_chunk_of(void* slot){
+    return (struct m61_chunk*) ((uintptr_t) slot & ~(uintptr_t) (M61_CHUNK_SIZE - 1));
+}
+
+/**
+ * Moves the slots other threads returned to this heap onto its free lists.
+ *
+ * @param heap - heap of the calling thread
+ */
+static void m61_drain_remote(struct m61_heap* heap){
+    char* slot = __atomic_exchange_n(&heap->remote, NULL, __ATOMIC_ACQUIRE);
+    while (slot != NULL){
+        char* next = *(void**) (slot + M61_HEADER_SIZE);
+        int sclass = m61_chunk_of(slot)->sclass;
+        *(void**) (slot + M61_HEADER_SIZE) = heap->free[sclass];
+        heap->free[sclass] = slot;
+        slot = next;
+    }
+}
+
+/**
+ * Carves the next never-used slot out of a chunk. In a guarded chunk, slots
+ * come in runs of whole pages closed by a PROT_NONE page; each run is
+ * right-aligned so that its last slot ends exactly at the guard page.
+ *
+ * @param chunk - chunk being carved
+ * @param size - slot size of the chunk's class
+ * @return slot - beginning of the slot, or NULL if the chunk is exhausted
+ */
+static char* m61_chunk_carve(struct m61_chunk* chunk, size_t size){
+    if (chunk->guarded && (chunk->run_end == NULL || chunk->bump + size > chunk->run_end)){
+        size_t run = (size + page_size - 1) & ~(page_size - 1);
+        char* start = chunk->run_end != NULL ? chunk->run_end + page_size
+            : (char*) (((uintptr_t) chunk->bump + page_size - 1) & ~(uintptr_t) (page_size - 1));
+        if (start + run + page_size > chunk->end){
+            return NULL;
+        }
+        chunk->run_end = start + run;
+        chunk->bump = start + run % size;
+        mprotect(chunk->run_end, page_size, PROT_NONE);
+
+        pthread_mutex_lock(&meta_lock);
+        m61_hash_insert(&guard_index, chunk->run_end, chunk->run_end - size);
+        pthread_mutex_unlock(&meta_lock);
+    }
+    if (chunk->bump + size > chunk->end){
+        return NULL;
+    }
+    char* slot = chunk->bump;
+    chunk->bump += size;
+    return slot;
+}
+
+/**
+ * Takes a slot from a size class: the most recently freed one if any,
+ * otherwise the next never-used slot of the current chunk.
+ *
+ * @param heap - heap of the calling thread
+ * @param sclass - size class index
+ * @return slot - beginning of the slot, or NULL if out of memory
+ */
+static void* m61_slab_alloc(struct m61_heap* heap, int sclass){
+    if (heap->free[sclass] == NULL && __atomic_load_n(&heap->remote, __ATOMIC_RELAXED) != NULL){
+        m61_drain_remote(heap);
+    }
+
+    char* slot = heap->free[sclass];
+    if (slot != NULL){
+        heap->free[sclass] = *(void**) (slot + M61_HEADER_SIZE);
+        return slot;
+    }
+
+    size_t size = m61_class_size(sclass);
+    struct m61_chunk * chunk = heap->current[sclass];
+    slot = chunk != NULL ? m61_chunk_carve(chunk, size) : NULL;
+    if (slot == NULL){
+        chunk = m61_chunk_create(heap, sclass);
+        if (chunk == NULL){
+            return NULL;
+        }
+        heap->current[sclass] = chunk;
+        slot = m61_chunk_carve(chunk, size);
+    }
+    if (slot != NULL){
+        m61_counter_add(&heap->class_carved[sclass], size);
+    }
+    return slot;
+}
+
+/**
+ * Returns a slot to the heap that owns its chunk: directly onto the free
+ * list when called by the owner, otherwise through the owner's return queue.
+ * The link is stored in the data area so the header stays intact for
+ * double-free diagnostics.
+ *
+ * @param heap - heap of the calling thread
+ * @param slot - beginning of the slot
+ */
+static void m61_slab_free(struct m61_heap* heap, void* slot){
+    struct m61_chunk * chunk = m61_chunk_of(slot);
+    void** link = (void**) ((char*) slot + M61_HEADER_SIZE);
+
+    if (chunk->owner == heap){
+        *link = heap->free[chunk->sclass];
+        heap->free[chunk->sclass] = slot;
+    }
+    else {
+        struct m61_heap * owner = chunk->owner;
+        *link = __atomic_load_n(&owner->remote, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&owner->remote, link, slot, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+        }
+    }
+}
+
+/**
+ * Hashes an allocation site into a slot of a sketch's index.
+ *
+ * @param file - file name of the site
+ * @param line - line number of the site
+ * @return slot - first slot to probe
+ */
+static unsigned m61_hh_hash(const char* file, int line){
+    uintptr_t key = ((uintptr_t) file >> 3) ^ ((uintptr_t) line * 0x9E3779B1U);
+    return (unsigned) (key ^ (key >> 11)) & (M61_HH_INDEX_SIZE - 1);
+}
+
+/**
+ * Finds the index slot of a site, or the empty slot where it would go.
+ *
+ * @param sketch - heavy-hitter sketch
+ * @param file - file name of the site
+ * @param line - line number of the site
+ * @return slot - index slot
+ */
+static unsigned m61_hh_find(struct m61_hh_sketch* sketch, const char* file, int line){
+    unsigned slot = m61_hh_hash(file, line);
+    while (sketch->index[slot] != 0){
+        struct m61_hh_counter * counter = &sketch->counters[sketch->index[slot] - 1];
+        if (counter->file == file && counter->line == line){
+            break;
+        }
+        slot = (slot + 1) & (M61_HH_INDEX_SIZE - 1);
+    }
+    return slot;
+}
+
+/**
+ * Removes a site from the index, shifting back later entries of the probe
+ * sequence so lookups never need tombstones.
+ *
+ * @param sketch - heavy-hitter sketch
+ * @param slot - index slot of the site
+ */
+static void m61_hh_unindex(struct m61_hh_sketch* sketch, unsigned slot){
+    unsigned next = slot;
+    sketch->index[slot] = 0;
+    for (;;){
+        next = (next + 1) & (M61_HH_INDEX_SIZE - 1);
+        if (sketch->index[next] == 0){
+            return;
+        }
+        struct m61_hh_counter * counter = &sketch->counters[sketch->index[next] - 1];
+        unsigned home = m61_hh_hash(counter->file, counter->line);
+        //Moves the entry into the hole unless its home lies cyclically in (slot, next]
+        if (slot <= next ? (home <= slot || home > next) : (home <= slot && home > next)){
+            sketch->index[slot] = sketch->index[next];
+            sketch->index[next] = 0;
+            slot = next;
+        }
+    }
+}
+
+/**
+ * Restores the min-heap order after the counter at pos grew.
+ *
+ * @param sketch - heavy-hitter sketch
+ * @param pos - heap position of the counter
+ */
+static void m61_hh_sift_down(struct m61_hh_sketch* sketch, int pos){
+    for (;;){
+        int child = 2 * pos + 1;
+        if (child >= sketch->ncounters){
+            break;
+        }
+        if (child + 1 < sketch->ncounters
+            && sketch->counters[sketch->heap[child + 1]].count < sketch->counters[sketch->heap[child]].count){
+            child += 1;
+        }
+        if (sketch->counters[sketch->heap[pos]].count <= sketch->counters[sketch->heap[child]].count){
+            break;
+        }
+        unsigned char id = sketch->heap[pos];
+        sketch->heap[pos] = sketch->heap[child];
+        sketch->heap[child] = id;
+        sketch->counters[sketch->heap[pos]].heap_pos = pos;
+        sketch->counters[id].heap_pos = child;
+        pos = child;
+    }
+}
+
+/**
+ * Records weight for an allocation site in a sketch.
+ *
+ * @param sketch - heavy-hitter sketch
+ * @param file - file name of the site
+ * @param line - line number of the site
+ * @param weight - bytes or allocations to add
+ */
+static void m61_hh_record(struct m61_hh_sketch* sketch, const char* file, int line, unsigned long long weight){
+    struct m61_hh_counter * counter;
+    unsigned slot = m61_hh_find(sketch, file, line);
+    sketch->total += weight;
+
+    if (sketch->index[slot] != 0){
+        counter = &sketch->counters[sketch->index[slot] - 1];
+    }
+    else if (sketch->ncounters < M61_HH_COUNTERS){
+        //Free counter: starts with a count of 0, the smallest in the heap,
+        //so it is moved up to the root before growing below
+        int id = sketch->ncounters++;
+        counter = &sketch->counters[id];
+        counter->file = file;
+        counter->line = line;
+        counter->count = 0;
+        counter->error = 0;
+        counter->heap_pos = id;
+        sketch->heap[id] = id;
+        sketch->index[slot] = id + 1;
+        for (int pos = id; pos > 0; pos = (pos - 1) / 2){
+            int parent = (pos - 1) / 2;
+            unsigned char tmp = sketch->heap[parent];
+            sketch->heap[parent] = sketch->heap[pos];
+            sketch->heap[pos] = tmp;
+            sketch->counters[sketch->heap[pos]].heap_pos = pos;
+            sketch->counters[sketch->heap[parent]].heap_pos = parent;
+        }
+    }
+    else {
+        //Sketch full: the site takes over the minimum counter
+        counter = &sketch->counters[sketch->heap[0]];
+        m61_hh_unindex(sketch, m61_hh_find(sketch, counter->file, counter->line));
+        counter->file = file;
+        counter->line = line;
+        counter->error = counter->count;
+        sketch->index[m61_hh_find(sketch, file, line)] = sketch->heap[0] + 1;
+    }
+
+    counter->count += weight;
+    m61_hh_sift_down(sketch, counter->heap_pos);
+}
+
+/**
+ * Turns the per-site size and lifetime histograms on or off. Blocks
+ * allocated while they are off do not count in lifetimes.
+ * M61_HISTOGRAMS=1 in the environment turns them on at startup.
+ *
+ * @param enabled - TRUE to record histograms
+ */
+void m61_set_site_histograms(int enabled){
+    __atomic_store_n(&site_histograms, enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the log2 histogram bucket of a value.
+ *
+ * @param value - size or lifetime
+ * @return bucket - 0 for 0, else 1 + floor(log2(value))
+ */
+static inline int m61_hist_bucket(unsigned long long value){
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+/**
+ * Finds the entry of a site in the calling thread's site table, claiming
+ * a free slot on first sight. When the table is full, the last slot
+ * stands for every further site. Only the owner thread calls this.
+ *
+ * @param heap - heap of the calling thread
+ * @param file - file name of the site
+ * @param line - line number of the site
+ * @return site - site entry
+ */
+static struct m61_site * m61_site_find(struct m61_heap* heap, const char* file, int line){
+    if (heap->sites == NULL){
+        struct m61_site * sites = mmap(NULL, M61_SITES * sizeof(struct m61_site), PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(sites != MAP_FAILED);
+        __atomic_store_n(&heap->sites, sites, __ATOMIC_RELEASE);
+    }
+    if (file == NULL){
+        file = "?";
+    }
+    uintptr_t key = ((uintptr_t) file >> 3) ^ ((uintptr_t) line * 0x9E3779B9U);
+    key *= (uintptr_t) 0x9E3779B97F4A7C15ULL;
+    size_t slot = (size_t) (key >> 20) % (M61_SITES - 1);
+    for (int probes = 0; probes < M61_SITES - 1; probes++){
+        struct m61_site * site = &heap->sites[slot];
+        if (site->file == file && site->line == line){
+            return site;
+        }
+        if (site->file == NULL){
+            //Readers see the line before the file that publishes the slot
+            site->line = line;
+            __atomic_store_n(&site->file, file, __ATOMIC_RELEASE);
+            return site;
+        }
+        slot = (slot + 1) % (M61_SITES - 1);
+    }
+    struct m61_site * other = &heap->sites[M61_SITES - 1];
+    if (other->file == NULL){
+        __atomic_store_n(&other->file, "(other sites)", __ATOMIC_RELEASE);
+    }
+    return other;
+}
+
+/**
+ * Counts an allocation in its site's size histogram and stamps the block
+ * with its sequence number, if histograms are on.
+ *
+ * @param heap - heap of the calling thread
+ * @param header - header of the new block, with size, file and line set
+ */
+static void m61_site_alloc(struct m61_heap* heap, struct m61_header* header){
+    if (!__atomic_load_n(&site_histograms, __ATOMIC_RELAXED)){
+        header->seq = 0;
+        return;
+    }
+    header->seq = __atomic_add_fetch(&alloc_seq, 1, __ATOMIC_RELAXED);
+    struct m61_site * site = m61_site_find(heap, header->file, header->line);
+    m61_counter_add(&site->nallocs, 1);
+    m61_counter_add(&site->nbytes, header->size);
+    m61_counter_add(&site->size_hist[m61_hist_bucket(header->size)], 1);
+}
+
+/**
+ * Counts a free in the lifetime histogram of the site that allocated the
+ * block, if its allocation was counted.
+ *
+ * @param heap - heap of the calling thread
+ * @param header - header of the block being freed
+ */
+static void m61_site_free(struct m61_heap* heap, struct m61_header* header){
+    if (header->seq == 0){
+        return;
+    }
+    unsigned long long lifetime = __atomic_load_n(&alloc_seq, __ATOMIC_RELAXED) - header->seq;
+    struct m61_site * site = m61_site_find(heap, header->file, header->line);
+    m61_counter_add(&site->nfrees, 1);
+    m61_counter_add(&site->lifetime_hist[m61_hist_bucket(lifetime)], 1);
+}
+
+/**
+ * Sets the sampling rate. With a rate of N, allocations are sampled as if
+ * each byte were picked with probability 1/N (a Poisson process over the
+ * bytes allocated, as in tcmalloc's heap profiler). Only sampled blocks get
+ * a node and feed the heavy-hitter sketches; the others only update the
+ * statistics counters.
+ *
+ * @param rate - mean bytes between samples, or 0 to track every allocation
+ */
+void m61_set_sample_rate(size_t rate){
+    __atomic_store_n(&sample_rate, rate, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sets how many return addresses are captured for each tracked allocation
+ * from now on, up to M61_STACK_DEPTH. M61_STACKS=<depth> in the
+ * environment does the same.
+ *
+ * @param depth - number of frames, or 0 to stop capturing
+ */
+void m61_set_stack_depth(int depth){
+    if (depth < 0){
+        depth = 0;
+    }
+    if (depth > M61_STACK_DEPTH){
+        depth = M61_STACK_DEPTH;
+    }
+    __atomic_store_n(&stack_depth, depth, __ATOMIC_RELAXED);
+}
+
+/**
+ * Captures the call stack of the caller of m61, if capture is on.
+ * Runs without locks; the result is interned by m61_stack_intern.
+ *
+ * @param frames - receives up to M61_STACK_DEPTH return addresses
+ * @return depth - number of frames captured (0 when capture is off)
+ */
+static __attribute__((noinline)) int m61_stack_capture(void** frames){
+    int depth = __atomic_load_n(&stack_depth, __ATOMIC_RELAXED);
+    if (depth == 0){
+        return 0;
+    }
+    //The two innermost frames are this function and its m61 caller
+    void* buffer[M61_STACK_DEPTH + 2];
+    int n = backtrace(buffer, depth + 2) - 2;
+    if (n <= 0){
+        return 0;
+    }
+    memcpy(frames, buffer + 2, n * sizeof(void*));
+    return n;
+}
+
+/**
+ * Hashes the frames of a call stack.
+ *
+ * @param frames - return addresses
+ * @param depth - number of frames
+ * @return hash - hash of the stack
+ */
+static unsigned m61_stack_hash(void** frames, int depth){
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < depth; i++){
+        hash = (hash ^ (uintptr_t) frames[i]) * 0x100000001b3ULL;
+        hash ^= hash >> 29;
+    }
+    return (unsigned) (hash ^ (hash >> 32));
+}
+
+/**
+ * Returns the id of a call stack, adding it to the stack table the first
+ * time it is seen. Called with meta_lock held.
+ *
+ * @param frames - return addresses from m61_stack_capture
+ * @param depth - number of frames
+ * @return id - stack id, or 0 if depth is 0
+ */
+static unsigned m61_stack_intern(void** frames, int depth){
+    if (depth == 0){
+        return 0;
+    }
+    unsigned hash = m61_stack_hash(frames, depth);
+
+    size_t slot = 0;
+    if (stack_slots_capacity != 0){
+        size_t mask = stack_slots_capacity - 1;
+        for (slot = hash & mask; stack_slots[slot] != 0; slot = (slot + 1) & mask){
+            struct m61_stack * stack = &stacks[stack_slots[slot] - 1];
+            if (stack->hash == hash && stack->depth == depth
+                && memcmp(stack->frames, frames, depth * sizeof(void*)) == 0){
+                return stack_slots[slot];
+            }
+        }
+    }
+
+    //New stack: grows the table and its index as needed, keeping the index at most half full
+    if (nstacks == stacks_capacity){
+        stacks_capacity = stacks_capacity ? stacks_capacity * 2 : 256;
+        stacks = realloc(stacks, stacks_capacity * sizeof(struct m61_stack));
+        assert(stacks != NULL);
+    }
+    if ((nstacks + 1) * 2 > stack_slots_capacity){
+        free(stack_slots);
+        stack_slots_capacity = stack_slots_capacity ? stack_slots_capacity * 2 : 512;
+        stack_slots = calloc(stack_slots_capacity, sizeof(unsigned));
+        assert(stack_slots != NULL);
+        for (size_t i = 0; i < nstacks; i++){
+            size_t s = stacks[i].hash & (stack_slots_capacity - 1);
+            while (stack_slots[s] != 0){
+                s = (s + 1) & (stack_slots_capacity - 1);
+            }
+            stack_slots[s] = (unsigned) i + 1;
+        }
+        slot = hash & (stack_slots_capacity - 1);
+        while (stack_slots[slot] != 0){
+            slot = (slot + 1) & (stack_slots_capacity - 1);
+        }
+    }
+
+    struct m61_stack * stack = &stacks[nstacks];
+    stack->hash = hash;
+    stack->depth = depth;
+    memcpy(stack->frames, frames, depth * sizeof(void*));
+    nstacks += 1;
+    stack_slots[slot] = (unsigned) nstacks;
+    return (unsigned) nstacks;
+}
+
+/**
+ * Returns the CLOCK_MONOTONIC time.
+ *
+ * @return time - nanoseconds
+ */
+static unsigned long long m61_now(void){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Starts tracing allocator events into a ring file, replacing its contents.
+ * M61_TRACE=<file> (and optionally M61_TRACE_RECORDS=<capacity>) in the
+ * environment does the same at startup.
+ *
+ * @param path - trace file
+ * @param capacity - number of records kept; older ones are overwritten
+ * @return result - TRUE, or FALSE if the file could not be mapped
+ */
+int m61_set_trace_file(const char* path, size_t capacity){
+    if (capacity == 0){
+        capacity = M61_TRACE_RECORDS;
+    }
+    size_t size = sizeof(struct m61_trace_header) + capacity * sizeof(struct m61_trace_record);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        return FALSE;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, (off_t) size) == 0){
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED){
+        return FALSE;
+    }
+
+    struct m61_trace_header * header = map;
+    header->magic = M61_TRACE_MAGIC;
+    header->capacity = capacity;
+    header->count = 0;
+    trace_epoch = m61_now();
+    __atomic_store_n(&trace_records, (struct m61_trace_record*) (header + 1), __ATOMIC_RELAXED);
+    __atomic_store_n(&trace, header, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+/**
+ * Removes the statistics segment when the process exits.
+ */
+static void m61_shm_unlink(void){
+    if (__atomic_exchange_n(&shm, NULL, __ATOMIC_ACQ_REL) != NULL){
+        shm_unlink(shm_name);
+    }
+}
+
+/**
+ * Starts or stops publishing statistics to the shared-memory segment
+ * "/m61.<pid>", for m61top. M61_SHM=1 in the environment starts it.
+ *
+ * @param enabled - TRUE to publish
+ * @return result - TRUE, or FALSE if the segment could not be created
+ */
+int m61_set_shm_export(int enabled){
+    if (!enabled){
+        //Writers may still hold the mapping, so it is left in place
+        m61_shm_unlink();
+        return TRUE;
+    }
+    if (__atomic_load_n(&shm, __ATOMIC_ACQUIRE) != NULL){
+        return TRUE;
+    }
+
+    static int registered = FALSE;
+    snprintf(shm_name, sizeof(shm_name), "/m61.%d", (int) getpid());
+    int fd = shm_open(shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0){
+        return FALSE;
+    }
+    void* map = MAP_FAILED;
+    if (ftruncate(fd, sizeof(struct m61_shm)) == 0){
+        map = mmap(NULL, sizeof(struct m61_shm), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED){
+        shm_unlink(shm_name);
+        return FALSE;
+    }
+
+    struct m61_shm * segment = map;
+    segment->magic = M61_SHM_MAGIC;
+    segment->pid = (int) getpid();
+    __atomic_store_n(&shm, segment, __ATOMIC_RELEASE);
+    if (!registered){
+        registered = TRUE;
+        atexit(m61_shm_unlink);
+    }
+    m61_shm_publish();
+    return TRUE;
+}
+
+/**
+ * Appends an event to the trace, if tracing is on.
+ *
+ * @param op - MEM_ALLOC, MEM_FREE or M61_TRACE_REALLOC
+ * @param ptr - block allocated, resized or freed
+ * @param old_ptr - block before a resize, or NULL
+ * @param sz - size requested
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ */
+static void m61_trace(unsigned op, void* ptr, void* old_ptr, size_t sz, const char* file, int line){
+    struct m61_trace_header * header = __atomic_load_n(&trace, __ATOMIC_ACQUIRE);
+    if (header == NULL){
+        return;
+    }
+    unsigned long long index = __atomic_fetch_add(&header->count, 1, __ATOMIC_RELAXED);
+    struct m61_trace_record * record = &trace_records[index % header->capacity];
+
+    //FNV-1a over file name and line, so site ids are stable across runs
+    unsigned site = 2166136261U;
+    for (const char* c = file != NULL ? file : ""; *c != '\0'; c++){
+        site = (site ^ (unsigned char) *c) * 16777619U;
+    }
+    site = (site ^ (unsigned) line) * 16777619U;
+
+    //The op is written last, so readers skip records still being written
+    __atomic_store_n(&record->op, 0, __ATOMIC_RELAXED);
+    record->time = m61_now() - trace_epoch;
+    record->pointer = (uintptr_t) ptr;
+    record->old_pointer = (uintptr_t) old_ptr;
+    record->size = sz;
+    record->site = site;
+    __atomic_store_n(&record->op, op, __ATOMIC_RELEASE);
+}
+
+/**
+ * Decides whether an allocation is sampled.
+ *
+ * @param heap - heap of the calling thread
+ * @param sz - size of the allocation
+ * @return weight - number of allocations the sample stands for
+ *         (1 when every allocation is tracked), or 0 if not sampled
+ */
+static double m61_sample(struct m61_heap* heap, size_t sz){
+    size_t rate = __atomic_load_n(&sample_rate, __ATOMIC_RELAXED);
+    if (rate == 0){
+        return 1.0;
+    }
+
+    heap->bytes_until_sample -= (long long) sz;
+    if (heap->bytes_until_sample > 0){
+        return 0;
+    }
+
+    //Next interval is exponentially distributed with mean rate
+    if (heap->random == 0){
+        heap->random = ((uintptr_t) heap * 0x9E3779B97F4A7C15ULL) | 1;
+    }
+    heap->random ^= heap->random >> 12;
+    heap->random ^= heap->random << 25;
+    heap->random ^= heap->random >> 27;
+    double uniform = ((heap->random * 0x2545F4914F6CDD1DULL >> 11) + 1) * (1.0 / 9007199254740992.0);
+    heap->bytes_until_sample = (long long) (-log(uniform) * rate) + 1;
+
+    //A block of sz bytes is sampled with probability 1 - e^(-sz/rate)
+    double size = sz ? (double) sz : 1.0;
+    return 1.0 / (1.0 - exp(-size / rate));
+}
+
+/**
+ * SIGSEGV/SIGBUS handler of the guard-page mode. A fault inside a guard
+ * page is reported with the allocation site of the block it follows;
+ * any other fault falls through to the default action (the handler is
+ * installed with SA_RESETHAND, so returning re-raises it).
+ *
+ * @param sig - signal number
+ * @param info - fault information, including the faulting address
+ * @param context - unused
+ */
+static void m61_guard_fault(int sig, siginfo_t* info, void* context){
+    (void) sig, (void) context;
+    char* page = (char*) ((uintptr_t) info->si_addr & ~(uintptr_t) (page_size - 1));
+    struct m61_header * header = m61_hash_find(&guard_index, page);
+    if (header == NULL){
+        return;
+    }
+
+    //The overrun may have clobbered the header; a node survives it
+    char* data = (char*) header + M61_HEADER_SIZE;
+    struct m61_node * node = m61_hash_find(&node_index, data);
+    if (node != NULL && node->status == MEM_ALLOC){
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid access to %p, %zu bytes past the end of a %zu byte region allocated here\n",
+                node->file, node->line, info->si_addr, (size_t) ((char*) info->si_addr - data) - node->size, node->size);
+    }
+    else if (m61_check_header(header) && header->status == MEM_ALLOC){
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid access to %p, %zu bytes past the end of a %zu byte region allocated here\n",
+                header->file, header->line, info->si_addr, (size_t) ((char*) info->si_addr - data) - header->size, header->size);
+    }
+    else {
+        fprintf(stderr, "MEMORY BUG: invalid access to %p, in a guard page of the heap\n", info->si_addr);
+    }
+    abort();
+}
+
+/**
+ * Enables or disables the guard-page mode for blocks allocated from now
+ * on. Meant to be called before the first allocation; M61_GUARD=1 in the
+ * environment does the same.
+ *
+ * @param enabled - TRUE to place blocks against PROT_NONE pages
+ */
+void m61_set_guard_pages(int enabled){
+    if (enabled){
+        page_size = (size_t) sysconf(_SC_PAGESIZE);
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_sigaction = m61_guard_fault;
+        action.sa_flags = SA_SIGINFO | SA_RESETHAND;
+        sigaction(SIGSEGV, &action, NULL);
+        sigaction(SIGBUS, &action, NULL);
+    }
+    __atomic_store_n(&guard_pages, enabled, __ATOMIC_RELAXED);
+}
+
+/**
+ * Returns the size of the data pages of a guarded mapping (everything but
+ * the guard page): header, data, verification chars and alignment slack.
+ *
+ * @param sz - size of the block's data
+ * @return size - bytes mapped before the guard page
+ */
+static size_t m61_guarded_data_size(size_t sz){
+    size_t size = M61_HEADER_SIZE + sz + NUM_VERIFICATION_CHARS + M61_ALIGNMENT - 1;
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Maps a large block whose data ends right before a PROT_NONE page.
+ * The data is only moved down as far as M61_ALIGNMENT requires, and the
+ * verification chars sit in between.
+ *
+ * @param sz - size of the block's data
+ * @return header - header of the block, or NULL if the mapping failed
+ */
+static struct m61_header * m61_guarded_alloc(size_t sz){
+    //Sizes near SIZE_MAX would wrap around while rounding up to pages
+    if (sz > (size_t) -1 - M61_HEADER_SIZE - NUM_VERIFICATION_CHARS - M61_ALIGNMENT - 2 * page_size){
+        return NULL;
+    }
+    size_t data_size = m61_guarded_data_size(sz);
+    char* base = mmap(NULL, data_size + page_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED){
+        return NULL;
+    }
+    char* guard = base + data_size;
+    mprotect(guard, page_size, PROT_NONE);
+
+    char* data = (char*) ((uintptr_t) (guard - sz - NUM_VERIFICATION_CHARS) & ~(uintptr_t) (M61_ALIGNMENT - 1));
+    struct m61_header * header = m61_get_header(data);
+
+    pthread_mutex_lock(&meta_lock);
+    m61_hash_insert(&guard_index, guard, header);
+    pthread_mutex_unlock(&meta_lock);
+    m61_region_add(base, data_size + page_size);
+    return header;
+}
+
+/**
+ * Unmaps a block allocated by m61_guarded_alloc, guard page included.
+ *
+ * @param header - header of the block
+ */
+static void m61_guarded_free(struct m61_header* header){
+    char* end = (char*) header + M61_HEADER_SIZE + header->size + NUM_VERIFICATION_CHARS;
+    char* guard = (char*) (((uintptr_t) end + page_size - 1) & ~(uintptr_t) (page_size - 1));
+    size_t data_size = m61_guarded_data_size(header->size);
+
+    pthread_mutex_lock(&meta_lock);
+    m61_hash_remove(&guard_index, guard);
+    pthread_mutex_unlock(&meta_lock);
+    m61_region_remove(guard - data_size, data_size + page_size);
+    munmap(guard - data_size, data_size + page_size);
+}
+
+/**
+ * Returns the length of the dedicated mapping of a block.
+ *
+ * @param block_size - header + data + verification chars
+ * @return size - block_size rounded up to whole pages
+ */
+static inline size_t m61_mapped_size(size_t block_size){
+    return (block_size + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Maps a block of at least M61_MMAP_THRESHOLD bytes on its own. Fresh
+ * anonymous pages are zero, so m61_calloc does not clear such blocks.
+ *
+ * @param block_size - header + data + verification chars
+ * @return header - header of the block, or NULL if the mapping failed
+ */
+static struct m61_header * m61_mapped_alloc(size_t block_size){
+    if (block_size > (size_t) -1 - page_size){
+        return NULL;
+    }
+    size_t size = m61_mapped_size(block_size);
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED){
+        return NULL;
+    }
+    m61_region_add(base, size);
+    return (struct m61_header*) base;
+}
+
+/**
+ * Unmaps a block allocated by m61_mapped_alloc.
+ *
+ * @param header - header of the block, at the start of the mapping
+ */
+static void m61_mapped_free(struct m61_header* header){
+    size_t size = m61_mapped_size(M61_HEADER_SIZE + header->size + NUM_VERIFICATION_CHARS);
+    m61_region_remove(header, size);
+    munmap(header, size);
+}
+
+/**
+ * Gives the pages of a quarantined mapped block back to the OS, except
+ * the one holding its header. The address range stays reserved, and
+ * reads of the freed data return zeros, until the block is evicted.
+ *
+ * @param header - header of the block, at the start of the mapping
+ */
+static void m61_mapped_decommit(struct m61_header* header){
+    size_t size = m61_mapped_size(M61_HEADER_SIZE + header->size + NUM_VERIFICATION_CHARS);
+    if (size > page_size){
+        madvise((char*) header + page_size, size - page_size, MADV_DONTNEED);
+    }
+}
+
+/**
+ * Resizes a mapped block with mremap, so no byte is copied even when the
+ * mapping moves.
+ *
+ * @param header - header of the block, at the start of the mapping
+ * @param block_size - new header + data + verification chars
+ * @return header - header of the resized block, or NULL if it could not be remapped
+ */
+static struct m61_header * m61_mapped_resize(struct m61_header* header, size_t block_size){
+    if (block_size > (size_t) -1 - page_size){
+        return NULL;
+    }
+    size_t old_size = m61_mapped_size(M61_HEADER_SIZE + header->size + NUM_VERIFICATION_CHARS);
+    size_t size = m61_mapped_size(block_size);
+
+    //The region is re-registered wherever the block ends up
+    m61_region_remove(header, old_size);
+    void* base = mremap(header, old_size, size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED){
+        m61_region_add(header, old_size);
+        return NULL;
+    }
+    m61_region_add(base, size);
+    return (struct m61_header*) base;
+}
+
+/**
+ * Maps a new chunk for an arena and registers it as heap memory.
+ *
+ * @param prev - chunk allocated before this one, or NULL
+ * @param size - bytes needed after the chunk header
+ * @return chunk - new chunk, or NULL if the OS refused the mapping
+ */
+static struct m61_arena_chunk * m61_arena_chunk_create(struct m61_arena_chunk* prev, size_t size){
+    if (size > (size_t) -1 - M61_ARENA_CHUNK - page_size){
+        return NULL;
+    }
+    size = m61_mapped_size(size + sizeof(struct m61_arena_chunk));
+    if (size < M61_ARENA_CHUNK){
+        size = M61_ARENA_CHUNK;
+    }
+    struct m61_arena_chunk * chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED){
+        return NULL;
+    }
+    chunk->prev = prev;
+    chunk->size = size;
+    m61_region_add(chunk, size);
+    m61_update_heap_range((char*) chunk, (char*) chunk + size);
+    m61_counter_add(&m61_get_heap()->stats.arena_reserved, size);
+    return chunk;
+}
+
+/**
+ * Unmaps an arena chunk.
+ *
+ * @param chunk - chunk to release
+ */
+static void m61_arena_chunk_release(struct m61_arena_chunk* chunk){
+    m61_counter_add(&m61_get_heap()->stats.arena_reserved, -(unsigned long long) chunk->size);
+    m61_shadow_clear_range(chunk, chunk->size);
+    m61_region_remove(chunk, chunk->size);
+    munmap(chunk, chunk->size);
+}
+
+/**
+ * Creates an arena. Its blocks are bump-allocated and released all
+ * together by m61_arena_rewind or m61_arena_destroy; m61_free of one of
+ * them only checks it and marks it free.
+ *
+ * @return arena - new arena, or NULL if no memory was available
+ */
+struct m61_arena * m61_arena_create(void){
+    pthread_once(&init_once, m61_init);
+    struct m61_arena_chunk * chunk = m61_arena_chunk_create(NULL, sizeof(struct m61_arena));
+    if (chunk == NULL){
+        return NULL;
+    }
+    //The arena lives in its first chunk, right after the chunk header
+    struct m61_arena * arena = (struct m61_arena*) (chunk + 1);
+    arena->chunk = chunk;
+    arena->bump = (char*) (arena + 1);
+    arena->end = (char*) chunk + chunk->size;
+    arena->active = 0;
+    return arena;
+}
+
+/**
+ * Allocates sz bytes from an arena. The block has the same header and
+ * verification chars as any other m61 block.
+ *
+ * @param arena - arena to allocate from
+ * @param sz - number of bytes to be allocated
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return pointer - beginning of the block, or NULL if no memory was available
+ */
+void* m61_arena_alloc(struct m61_arena* arena, size_t sz, const char* file, int line){
+    struct m61_heap * heap = m61_get_heap();
+    if (sz > (size_t) -1 - M61_HEADER_SIZE - NUM_VERIFICATION_CHARS - M61_ALIGNMENT){
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, sz);
+        return NULL;
+    }
+    size_t block_size = (M61_HEADER_SIZE + sz + NUM_VERIFICATION_CHARS + M61_ALIGNMENT - 1) & ~(size_t) (M61_ALIGNMENT - 1);
+
+    //Blocks are carved with a bump pointer, chaining a new chunk when full
+    char* start = (char*) (((uintptr_t) arena->bump + M61_ALIGNMENT - 1) & ~(uintptr_t) (M61_ALIGNMENT - 1));
+    if (start > arena->end || block_size > (size_t) (arena->end - start)){
+        struct m61_arena_chunk * chunk = m61_arena_chunk_create(arena->chunk, block_size + M61_ALIGNMENT);
+        if (chunk == NULL){
+            m61_counter_add(&heap->stats.nfail, 1);
+            m61_counter_add(&heap->stats.fail_size, sz);
+            return NULL;
+        }
+        arena->chunk = chunk;
+        arena->end = (char*) chunk + chunk->size;
+        start = (char*) (((uintptr_t) (chunk + 1) + M61_ALIGNMENT - 1) & ~(uintptr_t) (M61_ALIGNMENT - 1));
+    }
+    arena->bump = start + block_size;
+    arena->active += sz;
+    m61_counter_add(&heap->stats.arena_active, sz);
+
+    struct m61_header * header = (struct m61_header*) start;
+    header->size = sz;
+    header->file = file;
+    header->line = line;
+    header->status = MEM_ALLOC;
+    header->magic = M61_HEADER_MAGIC ^ (unsigned) (uintptr_t) header;
+    header->sclass = M61_CLASS_ARENA;
+    header->node = NULL;
+    header->seq = 0;
+
+    char* data = start + M61_HEADER_SIZE;
+    m61_append_verification_chars(data, sz);
+#if M61_CHECKS
+    m61_shadow_set(data);
+#endif
+    return data;
+}
+
+/**
+ * Remembers the current allocation point of an arena.
+ *
+ * @param arena - arena
+ * @return mark - position to pass to m61_arena_rewind
+ */
+struct m61_arena_mark m61_arena_mark(struct m61_arena* arena){
+    struct m61_arena_mark mark = { arena->chunk, arena->bump, arena->active };
+    return mark;
+}
+
+/**
+ * Releases every block allocated from an arena since a mark, in time
+ * independent of the number of blocks. Chunks chained after the mark are
+ * unmapped.
+ *
+ * @param arena - arena
+ * @param mark - position returned by m61_arena_mark on this arena
+ */
+void m61_arena_rewind(struct m61_arena* arena, struct m61_arena_mark mark){
+    while (arena->chunk != mark.chunk){
+        struct m61_arena_chunk * chunk = arena->chunk;
+        arena->chunk = chunk->prev;
+        m61_arena_chunk_release(chunk);
+    }
+    m61_counter_add(&m61_get_heap()->stats.arena_active, -(unsigned long long) (arena->active - mark.active));
+    arena->bump = mark.bump;
+    arena->end = (char*) arena->chunk + arena->chunk->size;
+    m61_shadow_clear_range(arena->bump, arena->end - arena->bump);
+    arena->active = mark.active;
+}
+
+/**
+ * Releases an arena and every block allocated from it. If it is the
+ * calling thread's current arena, malloc goes back to the heap.
+ *
+ * @param arena - arena to destroy
+ */
+void m61_arena_destroy(struct m61_arena* arena){
+    if (current_arena == arena){
+        current_arena = NULL;
+    }
+    m61_counter_add(&m61_get_heap()->stats.arena_active, -(unsigned long long) arena->active);
+    struct m61_arena_chunk * chunk = arena->chunk;
+    while (chunk != NULL){
+        struct m61_arena_chunk * prev = chunk->prev;
+        m61_arena_chunk_release(chunk);
+        chunk = prev;
+    }
+}
+
+/**
+ * Makes malloc, calloc and realloc of the calling thread allocate from an
+ * arena, or from the heap again when arena is NULL.
+ *
+ * @param arena - arena, or NULL
+ * @return previous - previous current arena of the thread
+ */
+struct m61_arena * m61_set_current_arena(struct m61_arena* arena){
+    struct m61_arena * previous = current_arena;
+    current_arena = arena;
+    return previous;
+}
+
+/**
+ * Turns freshly obtained storage into an allocated block: fills its header
+ * and verification chars, and does the bookkeeping of the checking level
+ * (counters, sites, sampling, node, trace). Inlined, so call stacks
+ * captured here start at the caller of m61_malloc or m61_pool_alloc.
+ *
+ * @param heap - heap of the calling thread
+ * @param header - where the block starts
+ * @param sz - number of bytes of data
+ * @param sclass - size class of the block
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return pointer - beginning of the block's data
+ */
+static inline __attribute__((always_inline)) void* m61_block_init(struct m61_heap* heap, struct m61_header* header, size_t sz,
+                                                                  int sclass, const char* file, int line){
+    char * data = (char*) header + M61_HEADER_SIZE;
+
+    //Mark statistics as success
+    m61_counter_add(&heap->stats.nactive, 1);
+    m61_counter_add(&heap->stats.ntotal, 1);
+    m61_counter_add(&heap->stats.active_size, sz);
+    m61_counter_add(&heap->stats.total_size, sz);
+    m61_counter_add(&heap->stats.metadata, M61_HEADER_SIZE + NUM_VERIFICATION_CHARS);
+    if (sclass >= 0){
+        m61_counter_add(&heap->class_slots[sclass], 1);
+        m61_counter_add(&heap->class_bytes[sclass], sz);
+    }
+    
+#if M61_STATS
+    //Updates the heap_min and heap_max addresses
+    m61_update_heap_range(data, data + sz + NUM_VERIFICATION_CHARS);
+#endif
+
+    
+    //Fills the boundary tag in front of the block
+    header->size = sz;
+    header->file = file;
+    header->line = line;
+    header->status = MEM_ALLOC;
+    header->magic = M61_HEADER_MAGIC ^ (unsigned) (uintptr_t) header;
+    header->sclass = sclass;
+    header->node = NULL;
+
+    //Appends the verification digits at the end of memory block, to detect wild writes
+    m61_append_verification_chars(data, sz);
+#if M61_CHECKS
+    m61_shadow_set(data);
+#endif
+
+#if M61_STATS
+    m61_site_alloc(heap, header);
+
+    //Unsampled blocks stop here: only the counters above know about them
+    double weight = m61_sample(heap, sz);
+    if (weight > 0){
+        //Feeds the heavy-hitter sketches of the calling thread, scaled to estimate totals
+        m61_hh_record(&heap->hh_bytes, file, line, (unsigned long long) (sz * weight + 0.5));
+        m61_hh_record(&heap->hh_count, file, line, (unsigned long long) (weight + 0.5));
+#if M61_TRACK_NODES
+        void* frames[M61_STACK_DEPTH];
+        int depth = m61_stack_capture(frames);
+
+        //Adds one node to list of allocated memory blocks
+        pthread_mutex_lock(&meta_lock);
+        m61_add_to_list(data, sz, MEM_ALLOC, (char*) file, line);
+        tail->weight = weight;
+        tail->stack = m61_stack_intern(frames, depth);
+        header->node = tail;
+        m61_leak_site_add(tail, 1);
+        pthread_mutex_unlock(&meta_lock);
+#endif
+    }
+    
+    //Every M61_SHM_CHECK allocations, checks whether the statistics segment is due
+    if (__atomic_load_n(&shm, __ATOMIC_RELAXED) != NULL && (heap->stats.ntotal & (M61_SHM_CHECK - 1)) == 0){
+        m61_shm_publish();
+    }
+    m61_trace(MEM_ALLOC, data, NULL, sz, file, line);
+#endif
+    return data;
+}
+
+/**
+ * Gets the memory of a block (header + size + appended verification bytes).
+ * Small blocks come from the slabs, large ones from a guarded mapping,
+ * their own mapping above M61_MMAP_THRESHOLD, or the native allocator.
+ *
+ * @param heap - heap of the calling thread
+ * @param sz - number of bytes of data
+ * @param sclass - receives the size class of the block
+ * @return header - where the block starts, or NULL if no memory was available
+ */
+static struct m61_header * m61_block_storage(struct m61_heap* heap, size_t sz, int* sclass){
+    size_t block_size = M61_HEADER_SIZE + sz + NUM_VERIFICATION_CHARS;
+    struct m61_header * header;
+    *sclass = m61_size_class(block_size);
+    if (*sclass != M61_CLASS_LARGE){
+        header = (struct m61_header*) m61_slab_alloc(heap, *sclass);
+    }
+    else if (__atomic_load_n(&guard_pages, __ATOMIC_RELAXED)){
+        *sclass = M61_CLASS_GUARDED;
+        header = m61_guarded_alloc(sz);
+    }
+    else if (block_size >= M61_MMAP_THRESHOLD){
+        *sclass = M61_CLASS_MAPPED;
+        header = m61_mapped_alloc(block_size);
+    }
+    else {
+        header = (struct m61_header*) malloc(block_size);
+        if (header != NULL){
+            m61_region_add(header, block_size);
+        }
+    }
+    return header;
+}
+
+/**
+ * Allocate sz bytes of memory from the heap
+ *
+ * @param sz - number of bytes to be allocated
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return pointer - location in heap which marks the beginning of allocated space
+ */
+void* m61_malloc(size_t sz, const char* file, int line) {
+    (void) file, (void) line;   // avoid uninitialized variable warnings
+    //Inside an arena scope, blocks are carved from the arena
+    if (current_arena != NULL){
+        return m61_arena_alloc(current_arena, sz, file, line);
+    }
+    struct m61_heap * heap = m61_get_heap();
+    
+    //avoid overflowing the sz variable
+    if (sz > (size_t) -1 - M61_HEADER_SIZE - NUM_VERIFICATION_CHARS) {
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, sz);
+        return NULL;
+    }
+    
+    int sclass;
+    struct m61_header * header = m61_block_storage(heap, sz, &sclass);
+    
+    //If a problem occurred (eg: heap full), mark as fail
+    if (header == NULL){
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, sz);
+    	return NULL;
+    }
+
+    return m61_block_init(heap, header, sz, sclass, file, line);
+}
+
+/**
+ * Retrieves the boundary tag stored in front of a block.
+ * The header is not validated; see m61_check_header.
+ *
+ * @param ptr - pointer to beginning of allocated memory
+ * @return header - header of the block
+ */
+struct m61_header * m61_get_header(void* ptr){
+    return (struct m61_header*) ((char*) ptr - M61_HEADER_SIZE);
+}
+
+/**
+ * Checks that a header was written by m61_malloc, i.e. that the pointer
+ * it precedes is the beginning of a block.
+ *
+ * @param header - header to be verified
+ * @return result - TRUE or FALSE
+ */
+int m61_check_header(struct m61_header* header){
+    return header->magic == (M61_HEADER_MAGIC ^ (unsigned) (uintptr_t) header)
+        && (header->status == MEM_ALLOC || header->status == MEM_FREE);
+}
+
+/**
+ * Checks the verification chars after a block. Below M61_LEVEL 2 blocks
+ * have none, and every block passes.
+ *
+ * @param data - pointer to beginning of allocated memory
+ * @param sz - size of allocated memory
+ * @return result - TRUE or FALSE
+ */
+static inline int m61_check_verification_chars(char* data, size_t sz){
+#if M61_CHECKS
+    return data[sz] == END_OF_BLOCK;
+#else
+    return TRUE;
+#endif
+}
+
+/**
+ * Appends pre-defined verification characters at the end of memory block
+ * This will be used by "m61_free" to detect wild writes problem.
+ *
+ * @param data - pointer to beginning of allocated memory 
+ * @param size - size of allocated memory
+ */
+void m61_append_verification_chars(char* data, size_t sz){
+    
+    for (int i = sz; i < (int)sz + NUM_VERIFICATION_CHARS; i++){
+        data[i] = END_OF_BLOCK;
+    }
+}
+
+/**
+ * Hashes a block pointer into a slot of the node index.
+ * Blocks are at least 8-byte aligned, so the low bits carry no information.
+ *
+ * @param ptr - pointer to beginning of allocated memory
+ * @param capacity - number of slots in the table (power of 2)
+ * @return slot - index of the first slot to probe
+ */
+static size_t m61_hash_pointer(void* ptr, size_t capacity){
+    uintptr_t key = (uintptr_t) ptr >> 3;
+    //Fibonacci hashing spreads consecutive addresses over the whole table
+    key *= (uintptr_t) 0x9E3779B97F4A7C15ULL;
+    return (key ^ (key >> 16)) & (capacity - 1);
+}
+
+/**
+ * Doubles the capacity of the node index and re-inserts every entry.
+ *
+ * @param table - hash table to grow
+ */
+static void m61_hash_grow(struct m61_hashtable* table){
+    size_t capacity = table->capacity ? table->capacity * 2 : M61_HASH_MIN_CAPACITY;
+    void** keys = calloc(capacity, sizeof(void*));
+    void** values = calloc(capacity, sizeof(void*));
+    assert(keys && values);
+
+    for (size_t i = 0; i < table->capacity; i++){
+        if (table->keys[i] != NULL){
+            size_t slot = m61_hash_pointer(table->keys[i], capacity);
+            while (keys[slot] != NULL){
+                slot = (slot + 1) & (capacity - 1);
+            }
+            keys[slot] = table->keys[i];
+            values[slot] = table->values[i];
+        }
+    }
+
+    free(table->keys);
+    free(table->values);
+    table->keys = keys;
+    table->values = values;
+    m61_counter_add(&m61_get_heap()->stats.reserved, (capacity - table->capacity) * 2 * sizeof(void*));
+    m61_counter_add(&m61_get_heap()->stats.metadata, (capacity - table->capacity) * 2 * sizeof(void*));
+    table->capacity = capacity;
+}
+
+/**
+ * Maps an address to a value, replacing any older value (for the node
+ * index, the node of an older block allocated at the same address).
+ *
+ * @param table - hash table
+ * @param ptr - address used as key
+ * @param value - value stored for ptr
+ */
+static void m61_hash_insert(struct m61_hashtable* table, void* ptr, void* value){
+    //Keeps the load factor under 1/2 so probe sequences stay short
+    if ((table->size + 1) * 2 > table->capacity){
+        m61_hash_grow(table);
+    }
+
+    size_t slot = m61_hash_pointer(ptr, table->capacity);
+    while (table->keys[slot] != NULL && table->keys[slot] != ptr){
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    if (table->keys[slot] == NULL){
+        table->keys[slot] = ptr;
+        table->size += 1;
+    }
+    table->values[slot] = value;
+}
+
+/**
+ * Looks up the value stored for an address (for the node index, the most
+ * recent node allocated at a block pointer).
+ *
+ * @param table - hash table
+ * @param ptr - address used as key
+ * @return value - value for ptr, or NULL if ptr is not in the table
+ */
+static void* m61_hash_find(struct m61_hashtable* table, void* ptr){
+    if (table->capacity == 0 || ptr == NULL){
+        return NULL;
+    }
+
+    size_t slot = m61_hash_pointer(ptr, table->capacity);
+    while (table->keys[slot] != NULL){
+        if (table->keys[slot] == ptr){
+            return table->values[slot];
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    return NULL;
+}
+
+/**
+ * Removes an address from the table. Later entries of the probe
+ * sequence are shifted back into the hole, so no tombstones are needed.
+ *
+ * @param table - hash table
+ * @param ptr - address used as key
+ */
+static void m61_hash_remove(struct m61_hashtable* table, void* ptr){
+    if (table->capacity == 0){
+        return;
+    }
+    size_t mask = table->capacity - 1;
+    size_t hole = m61_hash_pointer(ptr, table->capacity);
+    while (table->keys[hole] != ptr){
+        if (table->keys[hole] == NULL){
+            return;
+        }
+        hole = (hole + 1) & mask;
+    }
+
+    for (size_t next = (hole + 1) & mask; table->keys[next] != NULL; next = (next + 1) & mask){
+        size_t home = m61_hash_pointer(table->keys[next], table->capacity);
+        //Moves the entry unless its home lies cyclically in (hole, next]
+        if (hole <= next ? (home <= hole || home > next) : (home <= hole && home > next)){
+            table->keys[hole] = table->keys[next];
+            table->values[hole] = table->values[next];
+            hole = next;
+        }
+    }
+    table->keys[hole] = NULL;
+    table->values[hole] = NULL;
+    table->size -= 1;
+}
+
+/**
+ * Returns the height of a subtree.
+ *
+ * @param entry - root of the subtree, or NULL
+ * @return height - 0 for an empty subtree
+ */
+static inline int m61_tree_height(struct m61_interval* entry){
+    return entry != NULL ? entry->height : 0;
+}
+
+/**
+ * Recomputes the height of an entry from its children.
+ *
+ * @param entry - entry whose children are up to date
+ */
+static inline void m61_tree_update(struct m61_interval* entry){
+    int left = m61_tree_height(entry->left);
+    int right = m61_tree_height(entry->right);
+    entry->height = (left > right ? left : right) + 1;
+}
+
+/**
+ * Rotates a subtree to the left (its right child becomes the root).
+ *
+ * @param entry - root of the subtree
+ * @return root - new root of the subtree
+ */
+static struct m61_interval * m61_tree_rotate_left(struct m61_interval* entry){
+    struct m61_interval * root = entry->right;
+    entry->right = root->left;
+    root->left = entry;
+    m61_tree_update(entry);
+    m61_tree_update(root);
+    return root;
+}
+
+/**
+ * Rotates a subtree to the right (its left child becomes the root).
+ *
+ * @param entry - root of the subtree
+ * @return root - new root of the subtree
+ */
+static struct m61_interval * m61_tree_rotate_right(struct m61_interval* entry){
+    struct m61_interval * root = entry->left;
+    entry->left = root->right;
+    root->right = entry;
+    m61_tree_update(entry);
+    m61_tree_update(root);
+    return root;
+}
+
+/**
+ * Restores the AVL invariant at an entry whose subtrees differ in height
+ * by at most 2.
+ *
+ * @param entry - root of the subtree
+ * @return root - new root of the subtree
+ */
+static struct m61_interval * m61_tree_balance(struct m61_interval* entry){
+    m61_tree_update(entry);
+    int balance = m61_tree_height(entry->left) - m61_tree_height(entry->right);
+    if (balance > 1){
+        if (m61_tree_height(entry->left->left) < m61_tree_height(entry->left->right)){
+            entry->left = m61_tree_rotate_left(entry->left);
+        }
+        return m61_tree_rotate_right(entry);
+    }
+    if (balance < -1){
+        if (m61_tree_height(entry->right->right) < m61_tree_height(entry->right->left)){
+            entry->right = m61_tree_rotate_right(entry->right);
+        }
+        return m61_tree_rotate_left(entry);
+    }
+    return entry;
+}
+
+/**
+ * Links an entry into a subtree.
+ *
+ * @param root - root of the subtree, or NULL
+ * @param entry - entry to link, with no children
+ * @return root - new root of the subtree
+ */
+static struct m61_interval * m61_tree_attach(struct m61_interval* root, struct m61_interval* entry){
+    if (root == NULL){
+        return entry;
+    }
+    if (entry->start < root->start){
+        root->left = m61_tree_attach(root->left, entry);
+    }
+    else {
+        root->right = m61_tree_attach(root->right, entry);
+    }
+    return m61_tree_balance(root);
+}
+
+/**
+ * Unlinks the lowest entry of a non-empty subtree.
+ *
+ * @param root - root of the subtree
+ * @param min - receives the unlinked entry
+ * @return root - new root of the subtree
+ */
+static struct m61_interval * m61_tree_detach_min(struct m61_interval* root, struct m61_interval** min){
+    if (root->left == NULL){
+        *min = root;
+        return root->right;
+    }
+    root->left = m61_tree_detach_min(root->left, min);
+    return m61_tree_balance(root);
+}
+
+/**
+ * Unlinks the entry starting at an address from a subtree.
+ *
+ * @param root - root of the subtree, or NULL
+ * @param start - key of the entry
+ * @param removed - receives the unlinked entry, untouched if not found
+ * @return root - new root of the subtree
+ */
+static struct m61_interval * m61_tree_detach(struct m61_interval* root, char* start, struct m61_interval** removed){
+    if (root == NULL){
+        return NULL;
+    }
+    if (start < root->start){
+        root->left = m61_tree_detach(root->left, start, removed);
+    }
+    else if (start > root->start){
+        root->right = m61_tree_detach(root->right, start, removed);
+    }
+    else {
+        //The successor takes the place of the removed entry
+        *removed = root;
+        if (root->right == NULL){
+            return root->left;
+        }
+        struct m61_interval * successor;
+        struct m61_interval * right = m61_tree_detach_min(root->right, &successor);
+        successor->left = root->left;
+        successor->right = right;
+        return m61_tree_balance(successor);
+    }
+    return m61_tree_balance(root);
+}
+
+/**
+ * Adds an interval to a tree. Intervals of a tree must not overlap.
+ * Called with the tree's lock held.
+ *
+ * @param tree - node tree or region tree
+ * @param start - first byte of the interval
+ * @param size - length in bytes
+ * @param value - value returned with the interval
+ */
+static void m61_tree_insert(struct m61_tree* tree, void* start, size_t size, void* value){
+    if (tree->pool == NULL){
+        struct m61_interval * batch = mmap(NULL, M61_NODE_BATCH * sizeof(struct m61_interval), PROT_READ | PROT_WRITE,
+                                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(batch != MAP_FAILED);
+        for (int i = 0; i < M61_NODE_BATCH; i++){
+            batch[i].right = tree->pool;
+            tree->pool = &batch[i];
+        }
+    }
+    struct m61_interval * entry = tree->pool;
+    tree->pool = entry->right;
+
+    entry->start = (char*) start;
+    entry->size = size;
+    entry->value = value;
+    entry->left = NULL;
+    entry->right = NULL;
+    entry->height = 1;
+    tree->root = m61_tree_attach(tree->root, entry);
+}
+
+/**
+ * Removes the interval starting at an address, if any, from a tree.
+ * Called with the tree's lock held.
+ *
+ * @param tree - node tree or region tree
+ * @param start - first byte of the interval
+ */
+static void m61_tree_remove(struct m61_tree* tree, void* start){
+    struct m61_interval * removed = NULL;
+    tree->root = m61_tree_detach(tree->root, (char*) start, &removed);
+    if (removed != NULL){
+        removed->right = tree->pool;
+        tree->pool = removed;
+    }
+}
+
+/**
+ * Finds the interval starting closest at or before an address. It is the
+ * only one that can contain the address; the caller checks that it does.
+ * Called with the tree's lock held.
+ *
+ * @param tree - node tree or region tree
+ * @param ptr - any address
+ * @return entry - interval with the greatest start <= ptr, or NULL
+ */
+static struct m61_interval * m61_tree_floor(struct m61_tree* tree, void* ptr){
+    struct m61_interval * floor = NULL;
+    struct m61_interval * entry = tree->root;
+    while (entry != NULL){
+        if (entry->start <= (char*) ptr){
+            floor = entry;
+            entry = entry->right;
+        }
+        else {
+            entry = entry->left;
+        }
+    }
+    return floor;
+}
+
+/**
+ * Returns the bitmap leaf covering an address, mapping it if asked to.
+ *
+ * @param address - any address below 2^M61_ADDRESS_BITS
+ * @param create - TRUE to map a missing leaf
+ * @return leaf - leaf of the address, or NULL if it has none
+ */
+static struct m61_page_leaf * m61_page_leaf(uintptr_t address, int create){
+    struct m61_page_leaf ** entry = &page_map[address >> M61_PAGE_LEAF_SHIFT];
+    struct m61_page_leaf * leaf = __atomic_load_n(entry, __ATOMIC_ACQUIRE);
+    if (leaf == NULL && create){
+        leaf = mmap(NULL, sizeof(struct m61_page_leaf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        assert(leaf != MAP_FAILED);
+        struct m61_page_leaf * expected = NULL;
+        if (!__atomic_compare_exchange_n(entry, &expected, leaf, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            //Another thread installed the leaf first
+            munmap(leaf, sizeof(struct m61_page_leaf));
+            leaf = expected;
+        }
+    }
+    return leaf;
+}
+
+/**
+ * Sets or clears the bits of every page overlapping a range.
+ *
+ * @param start - first byte of the range
+ * @param size - length in bytes
+ * @param shared - TRUE for the shared bits, FALSE for the owned bits
+ * @param set - TRUE to set the bits, FALSE to clear them
+ */
+static void m61_page_mark(void* start, size_t size, int shared, int set){
+    uintptr_t page = (uintptr_t) start >> M61_PAGE_SHIFT;
+    uintptr_t last = ((uintptr_t) start + size - 1) >> M61_PAGE_SHIFT;
+    const int bits = sizeof(unsigned long) * 8;
+    while (page <= last){
+        struct m61_page_leaf * leaf = m61_page_leaf(page << M61_PAGE_SHIFT, TRUE);
+        unsigned long * words = shared ? leaf->shared : leaf->owned;
+        size_t index = page & ((M61_PAGE_LEAF_WORDS * bits) - 1);
+
+        //Whole words at a time, up to the end of the range or of the word
+        size_t count = bits - index % bits;
+        if (count > last - page + 1){
+            count = last - page + 1;
+        }
+        unsigned long mask = (count == (size_t) bits ? ~0UL : ((1UL << count) - 1)) << (index % bits);
+        if (set){
+            __atomic_fetch_or(&words[index / bits], mask, __ATOMIC_RELEASE);
+        }
+        else {
+            __atomic_fetch_and(&words[index / bits], ~mask, __ATOMIC_RELEASE);
+        }
+        page += count;
+    }
+}
+
+/**
+ * Records a chunk, mapping or native block as owned by the allocator.
+ * Page-aligned regions only set owned bits; native blocks go into the
+ * region tree and mark their pages as shared.
+ *
+ * @param start - first byte of the region
+ * @param size - length in bytes
+ */
+static void m61_region_add(void* start, size_t size){
+    m61_counter_add(&m61_get_heap()->stats.reserved, size);
+    if (((uintptr_t) start | size) & ((1 << M61_PAGE_SHIFT) - 1)){
+        pthread_rwlock_wrlock(&region_lock);
+        m61_tree_insert(&region_tree, start, size, NULL);
+        pthread_rwlock_unlock(&region_lock);
+        m61_page_mark(start, size, TRUE, TRUE);
+    }
+    else {
+        m61_page_mark(start, size, FALSE, TRUE);
+    }
+}
 
 /**
- * Allocate sz bytes of memory from the heap
+ * Forgets a region before it is given back. Shared bits stay set, since
+ * other native blocks may share the pages; the region tree has the answer.
  *
- * @param sz - number of bytes to be allocated
- * @param file - caller's program file name
- * @param line - caller's program line number
- * @return pointer - location in heap which marks the beginning of allocated space
+ * @param start - first byte of the region
+ * @param size - length in bytes, as passed to m61_region_add
  */
-void* m61_malloc(size_t sz, const char* file, int line) {
-    (void) file, (void) line;   // avoid uninitialized variable warnings
-    
-    //avoid overflowing the sz variable
-    if (sz >= (size_t) - sizeof(struct m61_node) + NUM_VERIFICATION_CHARS) {
-        stats.nfail += 1;
-    	stats.fail_size += sz;
+static void m61_region_remove(void* start, size_t size){
+    m61_counter_add(&m61_get_heap()->stats.reserved, -(unsigned long long) size);
+    if (((uintptr_t) start | size) & ((1 << M61_PAGE_SHIFT) - 1)){
+        pthread_rwlock_wrlock(&region_lock);
+        m61_tree_remove(&region_tree, start);
+        pthread_rwlock_unlock(&region_lock);
+    }
+    else {
+        m61_page_mark(start, size, FALSE, FALSE);
+    }
+}
+
+/**
+ * Returns the shadow bitmap word and bit of a block start.
+ *
+ * @param ptr - block start
+ * @param create - TRUE to map a missing leaf
+ * @param mask - receives the bit of ptr in the word
+ * @return word - word holding the bit, or NULL if ptr has no leaf or is
+ *                not aligned like a block
+ */
+static unsigned long * m61_shadow_word(void* ptr, int create, unsigned long* mask){
+#if M61_CHECKS
+    const int bits = sizeof(unsigned long) * 8;
+    if (((uintptr_t) ptr & (M61_ALIGNMENT - 1)) != 0){
         return NULL;
     }
-    
-    //Calls native allocator for size + appended verification bytes
-    char * data = (char*) malloc(sz + NUM_VERIFICATION_CHARS);
-    
-    //If a problem occurred (eg: heap full), mark as fail
-    if (data == NULL){
-    	stats.nfail += 1;
-    	stats.fail_size += sz;
-    	return NULL;
+    struct m61_page_leaf * leaf = m61_page_leaf((uintptr_t) ptr, create);
+    if (leaf == NULL){
+        return NULL;
     }
-    else {
-        //Mark statistics as success
-    	stats.nactive += 1;
-    	stats.ntotal += 1;
-        stats.active_size += sz;
-        stats.total_size += sz;
-        
-        //Updates the heap_min and heap_max addresses
-        if (!stats.heap_min || stats.heap_min > data)
-        	stats.heap_min = data;
-    
-        if (!stats.heap_max || stats.heap_max < data)
-        	stats.heap_max = data + sz + (NUM_VERIFICATION_CHARS * sizeof(size_t));
+    size_t index = ((uintptr_t) ptr >> M61_GRANULE_SHIFT) & ((M61_SHADOW_LEAF_WORDS * bits) - 1);
+    *mask = 1UL << (index % bits);
+    return &leaf->starts[index / bits];
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * Marks a block start as live.
+ *
+ * @param ptr - data of a new block
+ */
+static void m61_shadow_set(void* ptr){
+    unsigned long mask;
+    unsigned long * word = m61_shadow_word(ptr, TRUE, &mask);
+    if (word != NULL){
+        __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);
     }
-    
-    //Appends the verification digits at the end of memory block, to detect wild writes
-    m61_append_verification_chars(data, sz);
-    //Adds one node to list of allocated memory blocks
-    m61_add_to_list(data, sz, MEM_ALLOC, (char*) file, line);
-    
-    return data;
 }
 
 /**
- * Appends pre-defined verification characters at the end of memory block
- * This will be used by "m61_free" to detect wild writes problem.
+ * Tells whether a live block starts at ptr.
  *
- * @param data - pointer to beginning of allocated memory 
- * @param size - size of allocated memory
+ * @param ptr - any pointer
+ * @return result - TRUE or FALSE
  */
-void m61_append_verification_chars(char* data, size_t sz){
-    
-    for (int i = sz; i < (int)sz + NUM_VERIFICATION_CHARS; i++){
-        data[i] = END_OF_BLOCK;
+static int m61_shadow_test(void* ptr){
+    unsigned long mask;
+    unsigned long * word = m61_shadow_word(ptr, FALSE, &mask);
+    return word != NULL && (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) != 0;
+}
+
+/**
+ * Unmarks a block start, telling whether it was live. Of two racing frees
+ * of a block, only one sees TRUE.
+ *
+ * @param ptr - pointer being freed
+ * @return result - TRUE if a live block started at ptr
+ */
+static int m61_shadow_test_and_clear(void* ptr){
+    unsigned long mask;
+    unsigned long * word = m61_shadow_word(ptr, FALSE, &mask);
+    return word != NULL && (__atomic_fetch_and(word, ~mask, __ATOMIC_RELAXED) & mask) != 0;
+}
+
+/**
+ * Unmarks every block start in a range whose blocks are released without
+ * m61_free (rewound arena blocks, objects of a destroyed pool).
+ *
+ * @param start - first byte of the range
+ * @param size - length in bytes
+ */
+static void m61_shadow_clear_range(void* start, size_t size){
+#if M61_CHECKS
+    const int bits = sizeof(unsigned long) * 8;
+    uintptr_t granule = ((uintptr_t) start + M61_ALIGNMENT - 1) >> M61_GRANULE_SHIFT;
+    uintptr_t end = ((uintptr_t) start + size) >> M61_GRANULE_SHIFT;
+    while (granule < end){
+        struct m61_page_leaf * leaf = m61_page_leaf(granule << M61_GRANULE_SHIFT, FALSE);
+        size_t index = granule & ((M61_SHADOW_LEAF_WORDS * bits) - 1);
+        size_t count = bits - index % bits;
+        if (count > end - granule){
+            count = end - granule;
+        }
+        unsigned long mask = (count == (size_t) bits ? ~0UL : ((1UL << count) - 1)) << (index % bits);
+        //Words without live starts are only read, so clean pages stay clean
+        if (leaf != NULL && (__atomic_load_n(&leaf->starts[index / bits], __ATOMIC_RELAXED) & mask) != 0){
+            __atomic_fetch_and(&leaf->starts[index / bits], ~mask, __ATOMIC_RELAXED);
+        }
+        granule += count;
+    }
+#endif
+}
+
+/**
+ * Takes a node from the node pool, carving a new batch when it is empty.
+ * Called with meta_lock held.
+ *
+ * @return node - uninitialized node
+ */
+static struct m61_node * m61_node_alloc(void){
+    if (node_pool == NULL){
+        struct m61_node * batch = mmap(NULL, M61_NODE_BATCH * sizeof(struct m61_node), PROT_READ | PROT_WRITE,
+                                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        assert(batch != MAP_FAILED);
+        m61_counter_add(&m61_get_heap()->stats.reserved, M61_NODE_BATCH * sizeof(struct m61_node));
+        m61_counter_add(&m61_get_heap()->stats.metadata, M61_NODE_BATCH * sizeof(struct m61_node));
+        for (int i = 0; i < M61_NODE_BATCH; i++){
+            batch[i].next = node_pool;
+            node_pool = &batch[i];
+        }
+    }
+    struct m61_node * node = node_pool;
+    node_pool = node->next;
+    return node;
+}
+
+/**
+ * Returns the slot of (file, line) in a leak site table: its entry, or
+ * the free slot where it belongs.
+ *
+ * @param sites - table
+ * @param capacity - number of slots (power of 2, never full)
+ * @param file - file name of the site
+ * @param line - line number of the site
+ * @return slot - entry or free slot
+ */
+static struct m61_leak_site * m61_leak_site_slot(struct m61_leak_site* sites, size_t capacity,
+                                                 const char* file, int line){
+    uintptr_t key = ((uintptr_t) file >> 3) ^ ((uintptr_t) line * 0x9E3779B9U);
+    key *= (uintptr_t) 0x9E3779B97F4A7C15ULL;
+    size_t slot = (size_t) (key >> 20) & (capacity - 1);
+    while (sites[slot].file != NULL && (sites[slot].file != file || sites[slot].line != line)){
+        slot = (slot + 1) & (capacity - 1);
+    }
+    return &sites[slot];
+}
+
+/**
+ * Returns the leak site entry of (file, line), claiming a free slot on
+ * first sight. Called with meta_lock held.
+ *
+ * @param file - file name of the site
+ * @param line - line number of the site
+ * @return site - site entry
+ */
+static struct m61_leak_site * m61_leak_site_find(const char* file, int line){
+    if (leak_sites_count * 2 >= leak_sites_capacity){
+        size_t capacity = leak_sites_capacity ? leak_sites_capacity * 2 : M61_LEAK_SITES_MIN_CAPACITY;
+        struct m61_leak_site * sites = calloc(capacity, sizeof(struct m61_leak_site));
+        assert(sites != NULL);
+        for (size_t i = 0; i < leak_sites_capacity; i++){
+            if (leak_sites[i].file != NULL){
+                struct m61_leak_site * entry = m61_leak_site_slot(sites, capacity, leak_sites[i].file, leak_sites[i].line);
+                *entry = leak_sites[i];
+            }
+        }
+        //Entries moved, so the live array is pointed at their new slots
+        for (size_t i = 0; i < live_sites_count; i++){
+            live_sites[i] = m61_leak_site_slot(sites, capacity, live_sites[i]->file, live_sites[i]->line);
+        }
+        free(leak_sites);
+        struct m61_heap * heap = m61_get_heap();
+        m61_counter_add(&heap->stats.reserved, (capacity - leak_sites_capacity) * sizeof(struct m61_leak_site));
+        m61_counter_add(&heap->stats.metadata, (capacity - leak_sites_capacity) * sizeof(struct m61_leak_site));
+        leak_sites = sites;
+        leak_sites_capacity = capacity;
+    }
+    struct m61_leak_site * site = m61_leak_site_slot(leak_sites, leak_sites_capacity, file, line);
+    if (site->file == NULL){
+        site->file = file;
+        site->line = line;
+        leak_sites_count += 1;
+    }
+    return site;
+}
+
+/**
+ * Counts a node's block in (sign 1) or out of (sign -1) the live blocks
+ * of its site. Called with meta_lock held.
+ *
+ * @param node - node of a live block
+ * @param sign - 1 when the block becomes live, -1 when it stops being live
+ */
+static void m61_leak_site_add(struct m61_node* node, int sign){
+    struct m61_leak_site * site = m61_leak_site_find(node->file, node->line);
+    //A site getting its first live block joins the live array
+    if (site->count == 0){
+        if (live_sites_count == live_sites_capacity){
+            size_t capacity = live_sites_capacity ? live_sites_capacity * 2 : M61_LEAK_SITES_MIN_CAPACITY;
+            struct m61_leak_site ** sites = realloc(live_sites, capacity * sizeof(struct m61_leak_site*));
+            assert(sites != NULL);
+            struct m61_heap * heap = m61_get_heap();
+            m61_counter_add(&heap->stats.reserved, (capacity - live_sites_capacity) * sizeof(struct m61_leak_site*));
+            m61_counter_add(&heap->stats.metadata, (capacity - live_sites_capacity) * sizeof(struct m61_leak_site*));
+            live_sites = sites;
+            live_sites_capacity = capacity;
+        }
+        site->live = live_sites_count;
+        live_sites[live_sites_count++] = site;
+    }
+    site->count += sign;
+    site->nobjects += sign * node->weight;
+    site->nbytes += sign * node->weight * node->size;
+    //Sampling weights do not cancel exactly; an empty site starts over from 0,
+    //and leaves the live array, the last live site taking its place
+    if (site->count == 0){
+        site->nobjects = 0;
+        site->nbytes = 0;
+        struct m61_leak_site * last = live_sites[--live_sites_count];
+        live_sites[site->live] = last;
+        last->live = site->live;
     }
 }
 
 /**
- * Adds a node with memory allocation metadata to the .
+ * Adds a node with memory allocation metadata to the end of the list,
+ * and indexes it by block pointer.
  *
  * @param ptr - pointer to beginning of allocated memory 
  * @param size - size of allocated memory
@@ -98,40 +2529,220 @@ void m61_append_verification_chars(char* data, size_t sz){
  */
 void m61_add_to_list(void* ptr, size_t size, int status, char* file, int line){
 
+    struct m61_node * new_node = m61_node_alloc();
+    
+    new_node->is_valid = TRUE;
+    new_node->pointer = ptr;
+    new_node->size = size;
+    new_node->status = status;
+    new_node->file = file;
+    new_node->line = line;
+    new_node->weight = 1.0;
+    new_node->stack = 0;
+    new_node->next = NULL;
+    new_node->prev = tail;
+
     //If list is empty
     if (head == NULL){
-        head = malloc(sizeof(struct m61_node));
-        
-        head->is_valid = TRUE;
-        head->pointer = ptr;
-        head->size = size;
-        head->status = status;
-        head->file = file;
-        head->line = line;
-        head->next = NULL;
-        head->prev = NULL;
+        head = new_node;
     }
     else {
-        struct m61_node * new_node = malloc(sizeof(struct m61_node));
-        
-        new_node->is_valid = TRUE;
-        new_node->pointer = ptr;
-        new_node->size = size;
-        new_node->status = status;
-        new_node->file = file;
-        new_node->line = line;
-        
-        //Gets last position in list
-        struct m61_node* temp = head;
-        while (temp->next != NULL){
-            temp = temp->next;
-        }
         //Bi-directionally points the new node to the last item
-        temp->next = new_node;
-        new_node->prev = temp;
-        new_node->next = NULL;
+        tail->next = new_node;
     }
-    
+    tail = new_node;
+
+    m61_hash_insert(&node_index, ptr, new_node);
+    m61_tree_insert(&node_tree, ptr, size, new_node);
+}
+
+/**
+ * Returns where an M61_CLASS_ALIGNED block keeps the header of the block it
+ * was carved from: the word right before its own header.
+ *
+ * @param header - header of the aligned block
+ * @return enclosing - location of the enclosing block's header
+ */
+static inline struct m61_header ** m61_enclosing_block(struct m61_header* header){
+    return (struct m61_header**) header - 1;
+}
+
+/**
+ * Gives the memory of a block back to its slab, to the OS or to native's free.
+ * An aligned block gives back the block it was carved from.
+ *
+ * @param heap - heap of the calling thread
+ * @param header - header of the block
+ */
+static void m61_release_block(struct m61_heap* heap, struct m61_header* header){
+    m61_counter_add(&heap->stats.metadata, -(unsigned long long) (M61_HEADER_SIZE + NUM_VERIFICATION_CHARS));
+    if (header->sclass >= 0){
+        m61_counter_add(&heap->class_slots[header->sclass], -1ULL);
+        m61_counter_add(&heap->class_bytes[header->sclass], -(unsigned long long) header->size);
+        m61_slab_free(heap, header);
+    }
+    else if (header->sclass == M61_CLASS_GUARDED){
+        m61_guarded_free(header);
+    }
+    else if (header->sclass == M61_CLASS_MAPPED){
+        m61_mapped_free(header);
+    }
+    else if (header->sclass == M61_CLASS_POOL){
+        m61_pool_release(heap, header);
+    }
+    else if (header->sclass == M61_CLASS_ALIGNED){
+        m61_release_block(heap, *m61_enclosing_block(header));
+    }
+    else {
+        m61_region_remove(header, M61_HEADER_SIZE + header->size + NUM_VERIFICATION_CHARS);
+        free(header);
+    }
+}
+
+/**
+ * Removes a node from the node index, the node tree and the node list.
+ * Called with meta_lock held.
+ *
+ * @param node - node to forget
+ */
+static void m61_node_unlink(struct m61_node* node){
+    m61_hash_remove(&node_index, node->pointer);
+    m61_tree_remove(&node_tree, node->pointer);
+    if (node->prev != NULL){
+        node->prev->next = node->next;
+    }
+    else {
+        head = node->next;
+    }
+    if (node->next != NULL){
+        node->next->prev = node->prev;
+    }
+    else {
+        tail = node->prev;
+    }
+}
+
+/**
+ * Puts the node of a freed block into the quarantine, evicting the oldest
+ * entries as needed to respect M61_QUARANTINE_SIZE and M61_QUARANTINE_BYTES.
+ *
+ * @param heap - heap of the calling thread
+ * @param node - node of the freed block
+ */
+static void m61_quarantine(struct m61_heap* heap, struct m61_node* node){
+    pthread_mutex_lock(&meta_lock);
+    if (node->status == MEM_ALLOC){
+        m61_leak_site_add(node, -1);
+    }
+    node->status = MEM_FREE;
+    quarantine[(quarantine_first + quarantine_count) % M61_QUARANTINE_SIZE] = node;
+    quarantine_count += 1;
+    quarantine_bytes += node->size;
+
+    while (quarantine_count > M61_QUARANTINE_SIZE - 1
+           || (quarantine_count > 1 && quarantine_bytes > M61_QUARANTINE_BYTES)){
+        struct m61_node * oldest = quarantine[quarantine_first];
+        quarantine_first = (quarantine_first + 1) % M61_QUARANTINE_SIZE;
+        quarantine_count -= 1;
+        quarantine_bytes -= oldest->size;
+
+        //Forgets the node, releases the block's memory, and recycles the node
+        m61_node_unlink(oldest);
+        m61_release_block(heap, m61_get_header(oldest->pointer));
+        oldest->next = node_pool;
+        node_pool = oldest;
+    }
+    pthread_mutex_unlock(&meta_lock);
+}
+
+/**
+ * Reports the free of a tracked pointer whose start bit was clear. The
+ * node index is authoritative; the header may be forged. Aborts with the
+ * diagnostic matching what the index knows of ptr.
+ *
+ * @param ptr - pointer passed to m61_free
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ */
+static void m61_report_tracked_free(void *ptr, const char *file, int line){
+    pthread_mutex_lock(&meta_lock);
+    struct m61_node * node = m61_find_node(ptr);
+
+    //If pointer is already free, returns error
+    if (node != NULL && node->status == MEM_FREE){
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p\n", file, line, ptr);
+        abort();
+    }
+    //Otherwise pointer was not previously allocated, at least not as a live block
+    fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+
+    //If the pointer is contained inside an allocated block of memory, shows detailed error message
+    struct m61_node * closest = node == NULL ? m61_find_node_with_closest_pointer(ptr) : NULL;
+    if (closest != NULL){
+        fprintf(stderr, "  %s:%d: %p is %zu bytes inside a %zu byte region allocated here\n", 
+                closest->file, closest->line, ptr, (size_t) ((char*) ptr - (char*) closest->pointer), closest->size);
+    }
+    abort();
+}
+
+/**
+ * Checks a block whose start bit was set, i.e. a live block: its header,
+ * node and verification chars must agree, or something wrote over them.
+ * The node is trusted from the header, so the node index is not searched.
+ * Aborts with a diagnostic otherwise.
+ *
+ * @param ptr - pointer passed to m61_free
+ * @param header - header in front of ptr
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return node - node of the block, or NULL if it has none
+ */
+static struct m61_node * m61_check_live_free(void *ptr, struct m61_header* header, const char *file, int line){
+    int valid = m61_check_header(header) && header->status == MEM_ALLOC
+                && m61_check_verification_chars(ptr, header->size);
+    struct m61_node * node = NULL;
+#if M61_TRACK_NODES
+    node = valid ? header->node : NULL;
+    if (node != NULL){
+        valid = node->pointer == ptr && node->is_valid && node->size == header->size;
+    }
+#endif
+    if (!valid){
+        fprintf( stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
+        abort();
+    }
+    return node;
+}
+
+/**
+ * Reports the free of a pointer whose start bit was clear, which is never
+ * a live block, and aborts. The checks only pick the diagnostic: not in
+ * heap, not allocated, or already freed.
+ *
+ * @param ptr - pointer passed to m61_free
+ * @param header - header in front of ptr, if ptr is a block at all
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ */
+static void m61_report_invalid_free(void *ptr, struct m61_header* header, const char *file, int line){
+    if (!m61_check_pointer_in_heap(ptr)){
+        fprintf( stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
+        abort();
+    }
+#if M61_TRACK_NODES
+    //Only a valid header without node (an unsampled block) skips the node index
+    if (!m61_check_header(header) || header->node != NULL){
+        m61_report_tracked_free(ptr, file, line);
+    }
+#endif
+    //Without nodes, a header marked free tells a double free; any other
+    //header (forged, restored, or of a rewound arena block) is not a live block
+    if (m61_check_header(header) && header->status == MEM_FREE){
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p\n", file, line, ptr);
+        abort();
+    }
+    fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
+    abort();
 }
 
 /**
@@ -150,68 +2761,78 @@ void m61_free(void *ptr, const char *file, int line) {
         return;
     }
     
-    //If pointer is not in heap range, returns error
-    if (!m61_check_pointer_in_heap(ptr)){
-        fprintf( stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not in heap\n", file, line, ptr);
-        abort();
+    struct m61_header * header = m61_get_header(ptr);
+    struct m61_node * node = NULL;
+#if M61_CHECKS
+    //One bit tells the start of a live block from anything else, and
+    //clearing it makes a second free of the block fail the same test.
+    //Without it the free is always invalid; the report tells how
+    if (!m61_shadow_test_and_clear(ptr)){
+        m61_report_invalid_free(ptr, header, file, line);
     }
-    //If pointer was not previously allocated and list of nodes was not overflown, returns error
-    if (head->is_valid && !m61_check_pointer_status(ptr, MEM_ALLOC)){
-        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated\n", file, line, ptr);
-        
-        //If the pointer is contained inside an allocated block of memory, shows detailed error message
-        struct m61_node * closest = m61_find_node_with_closest_pointer(ptr);
-        if (closest != NULL){
-            fprintf(stderr, "  %s:%d: %p is %d bytes inside a %d byte region allocated here\n", 
-                    closest->file, closest->line, ptr, ptr - closest->pointer, closest->size);
-        }
-        abort();
+    node = m61_check_live_free(ptr, header, file, line);
+#endif
+    
+    //Arena blocks only get marked free, so a second free is told from a
+    //rewound block; rewinding the arena releases them
+    if (header->sclass == M61_CLASS_ARENA){
+        __atomic_store_n(&header->status, MEM_FREE, __ATOMIC_RELEASE);
+        return;
     }
-    //If pointer is already free, returns error
-    else if (m61_check_pointer_status(ptr, MEM_FREE)){
-        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p\n", file, line, ptr);
-        abort();
+    //In case of success, updates the stats of the calling thread..
+    struct m61_heap * heap = m61_get_heap();
+    m61_counter_add(&heap->stats.active_size, -(unsigned long long) header->size);
+    m61_counter_add(&heap->stats.nactive, -1ULL);
+#if M61_STATS
+    m61_site_free(heap, header);
+#endif
+    
+    //..marks the block as free, so a second free is detected..
+    header->status = MEM_FREE;
+
+#if M61_STATS
+    m61_trace(MEM_FREE, ptr, NULL, 0, file, line);
+#endif
+
+    //..and quarantines tracked blocks, or releases untracked ones right away
+    if (node != NULL){
+        //A quarantined mapping keeps its address but not its data pages
+        if (header->sclass == M61_CLASS_MAPPED){
+            m61_mapped_decommit(header);
+        }
+        m61_quarantine(heap, node);
     }
-    //If write operation is detected outside the boundaries of the memory block, returns error
-    if (!m61_check_wild_write(ptr)){
-        fprintf( stderr, "MEMORY BUG: %s:%d: detected wild write during free of pointer %p\n", file, line, ptr);
-        abort();
+    else {
+        m61_release_block(heap, header);
     }
-    
-    //In case of success, updates the stats..
-    stats.active_size -= m61_get_pointer_size(ptr);
-    stats.nactive -= 1;
-    
-    //..frees the memory calling native's free,
-    free(ptr);
-    
-    //..and mark the node as status = MEM_FREE
-    struct m61_node * node = m61_find_node(ptr);
-    node->status = MEM_FREE;
 }
 
 /**
- * Iterates over list of nodes, trying to find a block of allocated memory 
- * such that the pointer is contained whitin the block 
+ * Finds the block of allocated (or quarantined) memory that contains the
+ * pointer, with a predecessor search in the node tree
  *
  * @param ptr - pointer to any memory location
  * @return node - node that contains pointer, or NULL if no such node was found
  */
 struct m61_node * m61_find_node_with_closest_pointer(void* ptr){
     
-    struct m61_node * closest = head;
+    pthread_mutex_lock(&meta_lock);
+    struct m61_node * closest = NULL;
     
-    while (closest != NULL){
-        if (ptr >= closest->pointer && ptr <= closest->pointer + closest->size){
-            return closest;
-        }
-        closest = closest->next;
+    //Blocks never overlap, so only the last one starting at or before ptr can contain it
+    struct m61_interval * entry = m61_tree_floor(&node_tree, ptr);
+    if (entry != NULL && (char*) ptr <= entry->start + entry->size){
+        closest = entry->value;
     }
-    return NULL;
+    pthread_mutex_unlock(&meta_lock);
+    return closest;
 }
 
 /**
- * Validates if pointer is referencing a valid position in heap memory space
+ * Validates if pointer is referencing a valid position in heap memory space,
+ * i.e. inside a chunk or large block currently owned by the allocator.
+ * Two loads in the page bitmap decide, except on pages shared with the
+ * native allocator, where the region tree is searched.
  *
  * @param ptr - pointer to any location in heap
  * @return result - TRUE or FALSE
@@ -219,23 +2840,73 @@ struct m61_node * m61_find_node_with_closest_pointer(void* ptr){
 int m61_check_pointer_in_heap (void *ptr){
     int result = FALSE;
     
-    char* pointer = (char*) ptr;
-    
-    //If heap was initialized
-    if (stats.heap_min != NULL && stats.heap_max != NULL){
-        
-        //If ptr is within heap range
-        if (stats.heap_min <= pointer && stats.heap_max >= pointer){
+    uintptr_t address = (uintptr_t) ptr;
+    const int bits = sizeof(unsigned long) * 8;
+
+    //If ptr is in the address space covered by the bitmap, and its page has a leaf..
+    struct m61_page_leaf * leaf = (uint64_t) address >> M61_ADDRESS_BITS ? NULL : m61_page_leaf(address, FALSE);
+    if (leaf != NULL){
+        size_t index = (address >> M61_PAGE_SHIFT) & ((M61_PAGE_LEAF_WORDS * bits) - 1);
+        unsigned long bit = 1UL << (index % bits);
+
+        //..an owned page is heap, and a shared page needs the region tree
+        if (__atomic_load_n(&leaf->owned[index / bits], __ATOMIC_ACQUIRE) & bit){
             result = TRUE;
         }
+        else if (__atomic_load_n(&leaf->shared[index / bits], __ATOMIC_ACQUIRE) & bit){
+            char* pointer = (char*) ptr;
+            pthread_rwlock_rdlock(&region_lock);
+            struct m61_interval * entry = m61_tree_floor(&region_tree, pointer);
+            if (entry != NULL && pointer < entry->start + entry->size){
+                result = TRUE;
+            }
+            pthread_rwlock_unlock(&region_lock);
+        }
     }
 
     return result;
 }
 
 /**
- * Retrieves the node corresponding to pointer argument and check if 
- * node status is as expected
+ * Finds the validated header of the block starting at ptr.
+ * For blocks tracked by a node the node index is authoritative; for
+ * untracked blocks (no node tracking, or not sampled) the header's magic
+ * is checked in place.
+ *
+ * @param ptr - pointer to heap memory block
+ * @return header - header of the block, or NULL if ptr is not a block
+ */
+static struct m61_header * m61_lookup_header(void *ptr){
+#if !M61_CHECKS
+    //Without checks, a pointer is trusted to be the beginning of a block
+    return ptr != NULL ? m61_get_header(ptr) : NULL;
+#endif
+    struct m61_header * header = m61_get_header(ptr);
+    //A live block start needs no search
+    if (m61_shadow_test(ptr) && m61_check_header(header)){
+        return header;
+    }
+    if (!m61_check_pointer_in_heap(ptr)){
+        return NULL;
+    }
+#if M61_TRACK_NODES
+    if (!m61_check_header(header) || header->node != NULL){
+        struct m61_node * node = m61_find_node(ptr);
+        if (node == NULL || !node->is_valid){
+            return NULL;
+        }
+        return header;
+    }
+#endif
+    if (!m61_check_header(header)){
+        return NULL;
+    }
+    return header;
+}
+
+/**
+ * Retrieves the metadata corresponding to pointer argument and check if 
+ * block status is as expected
  *
  * @param ptr - pointer to heap memory block
  * @param status - expected status (MEM_FREE or MEM_ALLOC)
@@ -244,40 +2915,35 @@ int m61_check_pointer_in_heap (void *ptr){
 int m61_check_pointer_status (void *ptr, int status){
     int result = FALSE;
     
+#if M61_TRACK_NODES
     struct m61_node * node = m61_find_node(ptr);
     if (node != NULL && node->is_valid){
         if (node->status == status){
             return TRUE;
         }
     }
+#else
+    struct m61_header * header = m61_lookup_header(ptr);
+    if (header != NULL && header->status == status){
+        return TRUE;
+    }
+#endif
 
     return result;
 }
 
 /*
- * Iterates over list of nodes, from last to first (more recent to last recent),
- * looking for a node which matches to pointer
+ * Looks up the node which matches to pointer in the node index.
+ * If the address was allocated more than once, the most recent node is returned.
  *
  * @param ptr - pointer to memory  block
- * @param status - expected status (MEM_FREE or MEM_ALLOC)
- * @return result - TRUE or FALSE
+ * @return node - node for ptr, or NULL if no such node was found
  */
 struct m61_node * m61_find_node(void *ptr){
-
-    struct m61_node * current = head;
-    
-    while (current->next != NULL){
-        current = current->next;
-    }
-    
-    while (current != NULL){
-        if (current->pointer == ptr){
-            return current;
-        } else {
-            current = current->prev;
-        }
-    }
-    return NULL;
+    pthread_mutex_lock(&meta_lock);
+    struct m61_node * node = m61_hash_find(&node_index, ptr);
+    pthread_mutex_unlock(&meta_lock);
+    return node;
 }
 
 /*
@@ -290,26 +2956,148 @@ struct m61_node * m61_find_node(void *ptr){
 int m61_check_wild_write(void *ptr){
     int result = TRUE;
     
-    //Check if node list was overflown
-    if (!head->is_valid){
+    struct m61_header * header = m61_lookup_header(ptr);
+
+    //Check if header was overriden
+    if (header == NULL || !m61_check_header(header)){
         result = FALSE;
     }
     else {
-        //Reads the size+n position,
-        char* pointer = (char *) ptr;
-        int memory_block_size = m61_get_pointer_size(ptr);
-     
-        //.. if verification chars are not present, flag an error
-        if (pointer[memory_block_size] != END_OF_BLOCK) {
-            result = FALSE;
+        //Reads the size+n position,
+        char* pointer = (char *) ptr;
+     
+        //.. if verification chars are not present, flag an error
+        if (!m61_check_verification_chars(pointer, header->size)) {
+            result = FALSE;
+        }
+    }
+    return result;
+}
+
+/**
+ * Resizes a valid allocated block without going through malloc + copy + free:
+ * a slab block stays in its slot while the new size fits and still fills at
+ * least half of it, a mapped block is remapped, and a native large block
+ * is resized by the native realloc, as long as the new size keeps the
+ * block in the same kind of storage. Header, node and verification chars
+ * follow the block.
+ *
+ * @param heap - heap of the calling thread
+ * @param header - validated header of an allocated block
+ * @param sz - new size of the block's data (not 0)
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return pointer - the resized block, or NULL if it must be moved by copying
+ */
+static void* m61_realloc_in_place(struct m61_heap* heap, struct m61_header* header, size_t sz, const char* file, int line){
+    if (sz > (size_t) -1 - M61_HEADER_SIZE - NUM_VERIFICATION_CHARS){
+        return NULL;
+    }
+    size_t block_size = M61_HEADER_SIZE + sz + NUM_VERIFICATION_CHARS;
+    char* old_data = (char*) header + M61_HEADER_SIZE;
+    size_t old_size = header->size;
+
+    if (header->sclass >= 0){
+        size_t slot_size = m61_class_size(header->sclass);
+        if (block_size > slot_size || block_size * 2 < slot_size){
+            return NULL;
+        }
+        m61_counter_add(&heap->class_bytes[header->sclass], sz - old_size);
+    }
+    else if (header->sclass == M61_CLASS_MAPPED && block_size >= M61_MMAP_THRESHOLD){
+        struct m61_header * moved = m61_mapped_resize(header, block_size);
+        if (moved == NULL){
+            return NULL;
+        }
+        header = moved;
+    }
+    else if (header->sclass == M61_CLASS_LARGE && block_size > M61_MAX_SMALL && block_size < M61_MMAP_THRESHOLD){
+        //The region is re-registered wherever the block ends up
+        m61_region_remove(header, M61_HEADER_SIZE + old_size + NUM_VERIFICATION_CHARS);
+        struct m61_header * moved = (struct m61_header*) realloc(header, block_size);
+        if (moved == NULL){
+            m61_region_add(header, M61_HEADER_SIZE + old_size + NUM_VERIFICATION_CHARS);
+            return NULL;
+        }
+        m61_region_add(moved, block_size);
+        header = moved;
+    }
+    else {
+        //Guarded blocks sit against their guard page, and small sizes belong in the slabs
+        return NULL;
+    }
+
+    char* data = (char*) header + M61_HEADER_SIZE;
+#if M61_STATS
+    m61_update_heap_range(data, data + sz + NUM_VERIFICATION_CHARS);
+#endif
+#if M61_CHECKS
+    //The start bit moves with the block
+    if (data != old_data){
+        m61_shadow_test_and_clear(old_data);
+        m61_shadow_set(data);
+    }
+#endif
+
+    //Counts the resize as an allocation of sz bytes and a free of the old block
+    m61_counter_add(&heap->stats.ntotal, 1);
+    m61_counter_add(&heap->stats.total_size, sz);
+    m61_counter_add(&heap->stats.active_size, sz - old_size);
+
+    //The header is re-signed, since its magic depends on its address.
+    //For the histograms, the old block dies and a new one is born
+#if M61_STATS
+    m61_site_free(heap, header);
+#endif
+    header->size = sz;
+    header->file = file;
+    header->line = line;
+    header->magic = M61_HEADER_MAGIC ^ (unsigned) (uintptr_t) header;
+#if M61_STATS
+    m61_site_alloc(heap, header);
+
+    //Feeds the heavy-hitter sketches as the copying path's m61_malloc would:
+    //a tracked block keeps its weight, any other is sampled like a new block
+    double weight = header->node != NULL ? header->node->weight : m61_sample(heap, sz);
+    if (weight > 0){
+        m61_hh_record(&heap->hh_bytes, file, line, (unsigned long long) (sz * weight + 0.5));
+        m61_hh_record(&heap->hh_count, file, line, (unsigned long long) (weight + 0.5));
+    }
+#endif
+    m61_append_verification_chars(data, sz);
+
+#if M61_TRACK_NODES
+    struct m61_node * node = header->node;
+    if (node != NULL){
+        void* frames[M61_STACK_DEPTH];
+        int depth = m61_stack_capture(frames);
+
+        pthread_mutex_lock(&meta_lock);
+        m61_hash_remove(&node_index, old_data);
+        m61_tree_remove(&node_tree, old_data);
+        m61_leak_site_add(node, -1);
+        node->pointer = data;
+        node->size = sz;
+        node->file = (char*) file;
+        node->line = line;
+        m61_leak_site_add(node, 1);
+        if (depth != 0){
+            node->stack = m61_stack_intern(frames, depth);
         }
+        m61_hash_insert(&node_index, data, node);
+        m61_tree_insert(&node_tree, data, sz, node);
+        pthread_mutex_unlock(&meta_lock);
     }
-    return result;
+#endif
+#if M61_STATS
+    m61_trace(M61_TRACE_REALLOC, data, old_data, sz, file, line);
+#endif
+    return data;
 }
 
 /*
  * Reallocates an existing memory block with a new size, copying data
- * from source to destination.
+ * from source to destination unless the block can be resized in place.
  *
  * @param ptr - pointer to source memory block
  * @param sz - number of bytes to be copied
@@ -318,6 +3106,19 @@ int m61_check_wild_write(void *ptr){
  * @return new_pointer - pointer to destination memory block
  */
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
+    //Valid blocks are resized in place when possible; anything suspicious
+    //goes through m61_free below, which diagnoses it
+    if (ptr && sz) {
+        struct m61_header * header = m61_lookup_header(ptr);
+        if (header != NULL && header->status == MEM_ALLOC && m61_check_verification_chars(ptr, header->size)
+            && (header->node == NULL || header->node->size == header->size)) {
+            void* resized = m61_realloc_in_place(m61_get_heap(), header, sz, file, line);
+            if (resized != NULL) {
+                return resized;
+            }
+        }
+    }
+
     void* new_ptr = NULL;
     if (sz)
         new_ptr = m61_malloc(sz, file, line);
@@ -325,8 +3126,8 @@ void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
     if (ptr && new_ptr) {
         //..retrieves the source size,
         size_t ptr_size = m61_get_pointer_size(ptr);
-        //copy N bytes from source to destination
-        memcpy(new_ptr, ptr, ptr_size);
+        //copy what fits from source to destination
+        memcpy(new_ptr, ptr, ptr_size < sz ? ptr_size : sz);
         //append verification chars at the end of destination
         m61_append_verification_chars(new_ptr, sz);
     }
@@ -344,9 +3145,9 @@ void* m61_realloc(void* ptr, size_t sz, const char* file, int line) {
  */
 size_t m61_get_pointer_size(void* ptr){
     
-    struct m61_node *current = m61_find_node(ptr);
-    if (current != NULL){
-        return current->size;
+    struct m61_header *header = m61_lookup_header(ptr);
+    if (header != NULL){
+        return header->size;
     }
     else{
         return 0;
@@ -367,33 +3168,440 @@ void* m61_calloc(size_t nmemb, size_t sz, const char* file, int line) {
     // Avoids overflowing the size_t variable.
     //If error occurrs, add fail to statistics
     if (sz != 0 && nmemb > ((size_t)-1 / sz)){
-        stats.nfail += 1;
-    	stats.fail_size += (sz * nmemb);
+        struct m61_heap * heap = m61_get_heap();
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, sz * nmemb);
         return NULL;
     } 
     
     //Allocates the memory
     void* ptr = m61_malloc(nmemb * sz, file, line);
-    if (ptr)
-        //Sets all bytes to 0
+    //Sets all bytes to 0, unless they come from a fresh mapping
+    int sclass = ptr ? m61_get_header(ptr)->sclass : 0;
+    if (ptr && sclass != M61_CLASS_MAPPED && sclass != M61_CLASS_GUARDED)
         memset(ptr, 0, nmemb * sz);
     return ptr;
 }
 
+/**
+ * Creates a pool of objects of one size, e.g. m61_pool_create(sizeof(struct
+ * command)). Pool objects get the same header, verification chars,
+ * statistics and node as blocks from m61_malloc, without the size-class
+ * lookup, and each one starts on a cache line.
+ *
+ * @param object_size - bytes of each object
+ * @return pool - new pool, or NULL if no memory was available
+ */
+struct m61_pool * m61_pool_create(size_t object_size){
+    pthread_once(&init_once, m61_init);
+    if (object_size > (size_t) -1 - M61_POOL_DATA_OFFSET - NUM_VERIFICATION_CHARS - M61_CACHE_LINE - page_size){
+        return NULL;
+    }
+    struct m61_pool * pool = calloc(1, sizeof(struct m61_pool));
+    if (pool == NULL){
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->object_size = object_size;
+    pool->slot_size = (M61_POOL_DATA_OFFSET + object_size + NUM_VERIFICATION_CHARS + M61_CACHE_LINE - 1)
+                      & ~(size_t) (M61_CACHE_LINE - 1);
+    return pool;
+}
+
+/**
+ * Pushes a list of free slots onto a pool's stack of returned slots.
+ *
+ * @param pool - pool of the slots
+ * @param first - first slot of the list
+ * @param last - last slot of the list
+ */
+static void m61_pool_push(struct m61_pool* pool, char* first, char* last){
+    char** link = &((struct m61_pool_slot*) last)->next;
+    *link = __atomic_load_n(&pool->remote, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&pool->remote, link, first, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)){
+    }
+}
+
+/**
+ * Returns the calling thread's cache entry for a pool, taking the entry
+ * over if another pool holds it: that pool gets its cached slots back.
+ *
+ * @param heap - heap of the calling thread
+ * @param pool - pool
+ * @return cache - entry of the pool
+ */
+static struct m61_pool_cache * m61_pool_cache(struct m61_heap* heap, struct m61_pool* pool){
+    struct m61_pool_cache * cache = &heap->pool_caches[((uintptr_t) pool >> 4) % M61_POOL_CACHES];
+    if (__atomic_load_n(&cache->pool, __ATOMIC_RELAXED) != pool){
+        pthread_mutex_lock(&pools_lock);
+        //Rechecked under the lock: the previous pool may have been destroyed meanwhile
+        if (cache->pool != NULL && cache->free != NULL){
+            char* last = cache->free;
+            while (((struct m61_pool_slot*) last)->next != NULL){
+                last = ((struct m61_pool_slot*) last)->next;
+            }
+            m61_pool_push(cache->pool, cache->free, last);
+        }
+        cache->free = NULL;
+        cache->count = 0;
+        __atomic_store_n(&cache->pool, pool, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&pools_lock);
+    }
+    return cache;
+}
+
+/**
+ * Refills an empty thread cache: with every slot other threads returned
+ * to the pool, else with a batch of slots carved under the pool's lock,
+ * mapping a new chunk when the newest one is full.
+ *
+ * @param pool - pool
+ * @param cache - empty cache of the calling thread for the pool
+ * @return status - 0 on success, -1 if no memory was available
+ */
+static int m61_pool_refill(struct m61_pool* pool, struct m61_pool_cache* cache){
+    char* slot = __atomic_exchange_n(&pool->remote, NULL, __ATOMIC_ACQUIRE);
+    if (slot != NULL){
+        cache->free = slot;
+        for (cache->count = 0; slot != NULL; cache->count++){
+            slot = ((struct m61_pool_slot*) slot)->next;
+        }
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->bump == NULL || pool->slot_size > (size_t) (pool->end - pool->bump)){
+        size_t size = m61_mapped_size(M61_CACHE_LINE + pool->slot_size);
+        if (size < M61_POOL_CHUNK){
+            size = M61_POOL_CHUNK;
+        }
+        struct m61_pool_chunk * chunk = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (chunk == MAP_FAILED){
+            pthread_mutex_unlock(&pool->lock);
+            return -1;
+        }
+        chunk->next = pool->chunks;
+        chunk->size = size;
+        m61_region_add(chunk, size);
+        pool->chunks = chunk;
+        pool->bump = (char*) chunk + M61_CACHE_LINE;
+        pool->end = (char*) chunk + size;
+    }
+    //Carved in address order, so the cache hands them out in address order
+    char** link = &cache->free;
+    while (cache->count < M61_POOL_BATCH && pool->slot_size <= (size_t) (pool->end - pool->bump)){
+        struct m61_pool_slot * carved = (struct m61_pool_slot*) pool->bump;
+        carved->pool = pool;
+        *link = pool->bump;
+        link = &carved->next;
+        pool->bump += pool->slot_size;
+        cache->count += 1;
+    }
+    *link = NULL;
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/**
+ * Allocates one object from a pool, from the calling thread's cache of
+ * free slots, refilling it when empty.
+ *
+ * @param pool - pool to allocate from
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return pointer - beginning of the object, or NULL if no memory was available
+ */
+void* m61_pool_alloc(struct m61_pool* pool, const char* file, int line){
+    struct m61_heap * heap = m61_get_heap();
+    struct m61_pool_cache * cache = m61_pool_cache(heap, pool);
+    if (cache->free == NULL && m61_pool_refill(pool, cache) < 0){
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, pool->object_size);
+        return NULL;
+    }
+    char* slot = cache->free;
+    cache->free = ((struct m61_pool_slot*) slot)->next;
+    cache->count -= 1;
+
+    struct m61_header * header = (struct m61_header*) (slot + M61_POOL_DATA_OFFSET - M61_HEADER_SIZE);
+    return m61_block_init(heap, header, pool->object_size, M61_CLASS_POOL, file, line);
+}
+
+/**
+ * Returns the slot of a pool object.
+ *
+ * @param header - header of the object
+ * @return slot - start of the slot
+ */
+static inline struct m61_pool_slot * m61_pool_slot_of(struct m61_header* header){
+    return (struct m61_pool_slot*) ((char*) header + M61_HEADER_SIZE - M61_POOL_DATA_OFFSET);
+}
+
+/**
+ * Puts the slot of a freed pool object in the calling thread's cache for
+ * its pool, or back on the pool's stack if the thread does not cache the
+ * pool or its cache is full. Called by m61_release_block, possibly from
+ * the quarantine.
+ *
+ * @param heap - heap of the calling thread
+ * @param header - header of the object
+ */
+static void m61_pool_release(struct m61_heap* heap, struct m61_header* header){
+    struct m61_pool_slot * slot = m61_pool_slot_of(header);
+    struct m61_pool * pool = slot->pool;
+    struct m61_pool_cache * cache = &heap->pool_caches[((uintptr_t) pool >> 4) % M61_POOL_CACHES];
+    if (__atomic_load_n(&cache->pool, __ATOMIC_RELAXED) == pool && cache->count < M61_POOL_CACHE_MAX){
+        slot->next = cache->free;
+        cache->free = (char*) slot;
+        cache->count += 1;
+    }
+    else {
+        m61_pool_push(pool, (char*) slot, (char*) slot);
+    }
+}
+
+/**
+ * Frees an object of a pool, with the checks of m61_free. Also diagnoses
+ * a live block that does not come from this pool.
+ *
+ * @param pool - pool the object was allocated from
+ * @param ptr - object, or NULL
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ */
+void m61_pool_free(struct m61_pool* pool, void* ptr, const char* file, int line){
+#if M61_CHECKS
+    struct m61_header * header = ptr != NULL ? m61_lookup_header(ptr) : NULL;
+    if (header != NULL && header->status == MEM_ALLOC
+        && (header->sclass != M61_CLASS_POOL || m61_pool_slot_of(header)->pool != pool)){
+        fprintf(stderr, "MEMORY BUG: %s:%d: invalid free of pointer %p, not allocated from this pool\n", file, line, ptr);
+        abort();
+    }
+#endif
+    m61_free(ptr, file, line);
+}
+
+/**
+ * Releases a pool and unmaps its chunks. Objects still allocated are
+ * reported as leaks; freeing them afterwards is an invalid free, and
+ * their addresses may be handed out again.
+ *
+ * @param pool - pool to destroy
+ */
+void m61_pool_destroy(struct m61_pool* pool){
+#if M61_TRACK_NODES
+    //Quarantined objects of the pool are forgotten, so that evicting them
+    //later does not touch unmapped chunks
+    pthread_mutex_lock(&meta_lock);
+    size_t kept = 0;
+    for (size_t i = 0; i < quarantine_count; i++){
+        struct m61_node * node = quarantine[(quarantine_first + i) % M61_QUARANTINE_SIZE];
+        int owned = FALSE;
+        for (struct m61_pool_chunk * chunk = pool->chunks; chunk != NULL && !owned; chunk = chunk->next){
+            owned = (char*) node->pointer >= (char*) chunk && (char*) node->pointer < (char*) chunk + chunk->size;
+        }
+        if (owned){
+            quarantine_bytes -= node->size;
+            m61_node_unlink(node);
+            node->next = node_pool;
+            node_pool = node;
+        }
+        else {
+            quarantine[(quarantine_first + kept) % M61_QUARANTINE_SIZE] = node;
+            kept += 1;
+        }
+    }
+    quarantine_count = kept;
+
+    //Objects still allocated stay in the node list, to be reported as leaks,
+    //but leave the node index and tree, since their addresses may be reused
+    for (struct m61_pool_chunk * chunk = pool->chunks; chunk != NULL; chunk = chunk->next){
+        char* end = chunk == pool->chunks ? pool->bump : (char*) chunk + chunk->size;
+        for (char* slot = (char*) chunk + M61_CACHE_LINE; slot + pool->slot_size <= end; slot += pool->slot_size){
+            struct m61_node * node = m61_hash_find(&node_index, slot + M61_POOL_DATA_OFFSET);
+            if (node != NULL && node->status == MEM_ALLOC){
+                m61_hash_remove(&node_index, node->pointer);
+                m61_tree_remove(&node_tree, node->pointer);
+            }
+        }
+    }
+    pthread_mutex_unlock(&meta_lock);
+#endif
+    //Threads drop their cached slots of the pool, which are being unmapped
+    pthread_mutex_lock(&pools_lock);
+    for (struct m61_heap * heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        for (int i = 0; i < M61_POOL_CACHES; i++){
+            if (__atomic_load_n(&heap->pool_caches[i].pool, __ATOMIC_RELAXED) == pool){
+                heap->pool_caches[i].free = NULL;
+                heap->pool_caches[i].count = 0;
+                __atomic_store_n(&heap->pool_caches[i].pool, NULL, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    pthread_mutex_unlock(&pools_lock);
+    while (pool->chunks != NULL){
+        struct m61_pool_chunk * chunk = pool->chunks;
+        pool->chunks = chunk->next;
+        m61_shadow_clear_range(chunk, chunk->size);
+        m61_region_remove(chunk, chunk->size);
+        munmap(chunk, chunk->size);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/*
+ * Allocates sz bytes aligned to a power of 2. Alignments above
+ * M61_ALIGNMENT are carved from a larger block: the aligned block gets its
+ * own header and verification chars and is the one the statistics and
+ * leak report count, with size sz; releasing it releases the enclosing
+ * block.
+ *
+ * @param alignment - power of 2
+ * @param sz - number of bytes to be allocated
+ * @param file - caller's program file name
+ * @param line - caller's program line number
+ * @return pointer - beginning of the block, or NULL if no memory was available
+ */
+void* m61_memalign(size_t alignment, size_t sz, const char* file, int line) {
+    if (alignment <= M61_ALIGNMENT){
+        return m61_malloc(sz, file, line);
+    }
+    struct m61_heap * heap = m61_get_heap();
+    if (sz > (size_t) -1 - alignment - sizeof(struct m61_header*) - 2 * M61_HEADER_SIZE - NUM_VERIFICATION_CHARS){
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, sz);
+        return NULL;
+    }
+    //Room for the enclosing block's address and a second header before the
+    //aligned data, and for its verification chars after
+    size_t outer_size = sz + alignment + sizeof(struct m61_header*) + M61_HEADER_SIZE + NUM_VERIFICATION_CHARS;
+
+    //Inside an arena scope both blocks are arena blocks, released by the rewind
+    if (current_arena != NULL){
+        char* outer = m61_arena_alloc(current_arena, outer_size, file, line);
+        if (outer == NULL){
+            return NULL;
+        }
+#if M61_CHECKS
+        m61_shadow_test_and_clear(outer);
+#endif
+        current_arena->active -= outer_size - sz;
+        m61_counter_add(&heap->stats.arena_active, -(unsigned long long) (outer_size - sz));
+        char* data = (char*) (((uintptr_t) outer + sizeof(struct m61_header*) + M61_HEADER_SIZE + alignment - 1) & ~(uintptr_t) (alignment - 1));
+        struct m61_header * header = m61_get_header(data);
+        *header = *m61_get_header(outer);
+        header->size = sz;
+        header->magic = M61_HEADER_MAGIC ^ (unsigned) (uintptr_t) header;
+        m61_append_verification_chars(data, sz);
+#if M61_CHECKS
+        m61_shadow_set(data);
+#endif
+        return data;
+    }
+
+    //The enclosing block only holds the aligned one, so it gets a header for
+    //m61_release_block but no statistics, sites or node of its own
+    int sclass;
+    struct m61_header * outer = m61_block_storage(heap, outer_size, &sclass);
+    if (outer == NULL){
+        m61_counter_add(&heap->stats.nfail, 1);
+        m61_counter_add(&heap->stats.fail_size, sz);
+        return NULL;
+    }
+    outer->size = outer_size;
+    outer->file = file;
+    outer->line = line;
+    outer->status = MEM_ALLOC;
+    outer->magic = M61_HEADER_MAGIC ^ (unsigned) (uintptr_t) outer;
+    outer->sclass = sclass;
+    outer->node = NULL;
+    outer->seq = 0;
+    m61_counter_add(&heap->stats.metadata, M61_HEADER_SIZE + NUM_VERIFICATION_CHARS);
+    if (sclass >= 0){
+        m61_counter_add(&heap->class_slots[sclass], 1);
+        m61_counter_add(&heap->class_bytes[sclass], outer_size);
+    }
+
+    char* data = (char*) (((uintptr_t) outer + M61_HEADER_SIZE + sizeof(struct m61_header*) + M61_HEADER_SIZE + alignment - 1) & ~(uintptr_t) (alignment - 1));
+    struct m61_header * header = m61_get_header(data);
+    *m61_enclosing_block(header) = outer;
+    return m61_block_init(heap, header, sz, M61_CLASS_ALIGNED, file, line);
+}
+
 /*
- * Gets statistic data from global variable and assigns to reference parameter
+ * Merges the statistics shards of every thread and assigns them to the
+ * reference parameter. Shards are read without stopping their owners, so
+ * counters from concurrently running threads are a close snapshot.
  *
  * @param _stats - statistics reference parameter
  */
 void m61_getstatistics(struct m61_statistics* _stats) {
-    _stats->active_size = stats.active_size;
-    _stats->fail_size = stats.fail_size;
-    _stats->heap_max = stats.heap_max;
-    _stats->heap_min = stats.heap_min;
-    _stats->nactive = stats.nactive;
-    _stats->nfail = stats.nfail;
-    _stats->ntotal = stats.ntotal;
-    _stats->total_size = stats.total_size;
+    memset(_stats, 0, sizeof(struct m61_statistics));
+
+    for (struct m61_heap * heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        _stats->active_size += __atomic_load_n(&heap->stats.active_size, __ATOMIC_RELAXED);
+        _stats->fail_size += __atomic_load_n(&heap->stats.fail_size, __ATOMIC_RELAXED);
+        _stats->nactive += __atomic_load_n(&heap->stats.nactive, __ATOMIC_RELAXED);
+        _stats->nfail += __atomic_load_n(&heap->stats.nfail, __ATOMIC_RELAXED);
+        _stats->ntotal += __atomic_load_n(&heap->stats.ntotal, __ATOMIC_RELAXED);
+        _stats->total_size += __atomic_load_n(&heap->stats.total_size, __ATOMIC_RELAXED);
+        _stats->arena_active += __atomic_load_n(&heap->stats.arena_active, __ATOMIC_RELAXED);
+        _stats->arena_reserved += __atomic_load_n(&heap->stats.arena_reserved, __ATOMIC_RELAXED);
+        _stats->reserved += __atomic_load_n(&heap->stats.reserved, __ATOMIC_RELAXED);
+        _stats->metadata += __atomic_load_n(&heap->stats.metadata, __ATOMIC_RELAXED);
+    }
+    _stats->heap_max = __atomic_load_n(&heap_max, __ATOMIC_RELAXED);
+    _stats->heap_min = __atomic_load_n(&heap_min, __ATOMIC_RELAXED);
+}
+
+/**
+ * Turns the footprint section of m61_printstatistics on or off.
+ * M61_FOOTPRINT=1 in the environment turns it on at startup.
+ *
+ * @param enabled - TRUE to print the footprint
+ */
+void m61_set_footprint_report(int enabled){
+    __atomic_store_n(&footprint_report, enabled, __ATOMIC_RELAXED);
+}
+
+/*
+ * Prints what the heap costs beyond its data: bytes reserved and spent on
+ * metadata, then for each size class the slots in use (allocated or
+ * quarantined), their internal waste (slot bytes beyond header, data and
+ * verification chars) and the carved bytes lying free in the class. Free
+ * carved bytes estimate external fragmentation: they stay resident but
+ * can serve only their own class. Every number comes from counters.
+ *
+ * @param stats - merged statistics
+ */
+static void m61_print_footprint(struct m61_statistics* stats){
+    unsigned long long slots[M61_NCLASSES] = { 0 }, bytes[M61_NCLASSES] = { 0 }, carved[M61_NCLASSES] = { 0 };
+    for (struct m61_heap * heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        for (int i = 0; i < M61_NCLASSES; i++){
+            slots[i] += __atomic_load_n(&heap->class_slots[i], __ATOMIC_RELAXED);
+            bytes[i] += __atomic_load_n(&heap->class_bytes[i], __ATOMIC_RELAXED);
+            carved[i] += __atomic_load_n(&heap->class_carved[i], __ATOMIC_RELAXED);
+        }
+    }
+    unsigned long long total_carved = 0, total_free = 0;
+    for (int i = 0; i < M61_NCLASSES; i++){
+        total_carved += carved[i];
+        total_free += carved[i] - slots[i] * m61_class_size(i);
+    }
+
+    printf("footprint:    reserved %10llu   metadata %10llu   quarantined %10llu\n",
+           stats->reserved, stats->metadata, (unsigned long long) __atomic_load_n(&quarantine_bytes, __ATOMIC_RELAXED));
+    printf("slab memory:  carved %12llu   free %14llu   fragmentation %.1f%%\n",
+           total_carved, total_free, total_carved ? 100.0 * total_free / total_carved : 0.0);
+    for (int i = 0; i < M61_NCLASSES; i++){
+        if (carved[i] != 0){
+            size_t size = m61_class_size(i);
+            printf("  class %6zu: slots %8llu   waste %13llu   free %10llu\n", size, slots[i],
+                   slots[i] * (size - M61_HEADER_SIZE - NUM_VERIFICATION_CHARS) - bytes[i],
+                   carved[i] - slots[i] * size);
+        }
+    }
 }
 
 /*
@@ -409,25 +3617,423 @@ void m61_printstatistics(void) {
            stats.nactive, stats.ntotal, stats.nfail);
     printf("malloc size:  active %10llu   total %10llu   fail %10llu\n",
            stats.active_size, stats.total_size, stats.fail_size);
+    //Arena usage, once any arena exists
+    if (stats.arena_reserved != 0){
+        printf("arena size:   active %10llu   reserved %8llu\n",
+               stats.arena_active, stats.arena_reserved);
+    }
+    if (__atomic_load_n(&footprint_report, __ATOMIC_RELAXED)){
+        m61_print_footprint(&stats);
+    }
+}
+
+/* Leaked objects and bytes attributed to one call stack */
+struct m61_stack_leak {
+    unsigned stack;                     // stack id
+    double nobjects;                    // estimated leaked objects
+    double nbytes;                      // estimated leaked bytes
+};
+
+static int m61_stack_leak_compare(const void* a, const void* b){
+    const struct m61_stack_leak * x = a;
+    const struct m61_stack_leak * y = b;
+    return (x->nbytes < y->nbytes) - (x->nbytes > y->nbytes);
+}
+
+/*
+ * Aggregates the live nodes by call stack and prints each stack that
+ * leaked, largest first, with symbolized frames. Called with meta_lock held.
+ */
+static void m61_print_leaked_stacks(void){
+    struct m61_stack_leak * leaks = calloc(nstacks, sizeof(struct m61_stack_leak));
+    assert(leaks != NULL);
+    for (size_t i = 0; i < nstacks; i++){
+        leaks[i].stack = (unsigned) i + 1;
+    }
+    for (struct m61_node * current = head; current != NULL; current = current->next){
+        if (current->status == MEM_ALLOC && current->stack != 0){
+            leaks[current->stack - 1].nobjects += current->weight;
+            leaks[current->stack - 1].nbytes += current->weight * current->size;
+        }
+    }
+    qsort(leaks, nstacks, sizeof(struct m61_stack_leak), m61_stack_leak_compare);
+
+    for (size_t i = 0; i < nstacks && leaks[i].nobjects > 0; i++){
+        struct m61_stack * stack = &stacks[leaks[i].stack - 1];
+        printf("LEAK CHECK: stack %u: %.0f objects and %.0f bytes leaked\n",
+               leaks[i].stack, leaks[i].nobjects, leaks[i].nbytes);
+        char** symbols = backtrace_symbols(stack->frames, stack->depth);
+        for (int j = 0; j < stack->depth; j++){
+            printf("  #%d %s\n", j, symbols != NULL ? symbols[j] : "??");
+        }
+        //The symbols come from the process's malloc, which is m61 in libm61.so
+        (free)(symbols);
+    }
+    free(leaks);
+}
+
+/**
+ * Makes m61_printleakreport aggregate leaks by site and print only the
+ * top sites by bytes. M61_LEAK_SITES=<top> in the environment sets it at
+ * startup.
+ *
+ * @param top - sites to print, or 0 to print one line per leaked object
+ */
+void m61_set_leak_report_sites(size_t top){
+    __atomic_store_n(&leak_report_sites, top, __ATOMIC_RELAXED);
+}
+
+static int m61_leak_site_compare(const void* a, const void* b){
+    const struct m61_leak_site * x = a;
+    const struct m61_leak_site * y = b;
+    if (x->nbytes != y->nbytes){
+        return (x->nbytes < y->nbytes) - (x->nbytes > y->nbytes);
+    }
+    return x->line - y->line;
+}
+
+/*
+ * Prints the sites with live tracked blocks, most bytes first, the top
+ * sites one per line and the others summed up. Reads the leak site
+ * index, so it never walks the nodes.
+ *
+ * @param top - sites printed one per line
+ */
+static void m61_print_leaked_sites(size_t top){
+    pthread_mutex_lock(&meta_lock);
+    struct m61_leak_site * leaks = calloc(live_sites_count + 1, sizeof(struct m61_leak_site));
+    assert(leaks != NULL);
+    size_t nleaks = live_sites_count;
+    for (size_t i = 0; i < nleaks; i++){
+        leaks[i] = *live_sites[i];
+    }
+    pthread_mutex_unlock(&meta_lock);
+    qsort(leaks, nleaks, sizeof(struct m61_leak_site), m61_leak_site_compare);
+
+    size_t nsamples = 0, nother = 0;
+    double nobjects = 0, nbytes = 0, other_objects = 0, other_bytes = 0;
+    for (size_t i = 0; i < nleaks; i++){
+        if (i < top){
+            printf("LEAK CHECK: site %s:%d: %.0f objects, %.0f bytes\n",
+                   leaks[i].file, leaks[i].line, leaks[i].nobjects, leaks[i].nbytes);
+        }
+        else {
+            nother += 1;
+            other_objects += leaks[i].nobjects;
+            other_bytes += leaks[i].nbytes;
+        }
+        nsamples += leaks[i].count;
+        nobjects += leaks[i].nobjects;
+        nbytes += leaks[i].nbytes;
+    }
+    if (nother != 0){
+        printf("LEAK CHECK: %zu more sites: %.0f objects, %.0f bytes\n", nother, other_objects, other_bytes);
+    }
+    if (__atomic_load_n(&sample_rate, __ATOMIC_RELAXED) != 0){
+        printf("LEAK CHECK: %zu sampled objects, estimated %.0f objects and %.0f bytes leaked\n",
+               nsamples, nobjects, nbytes);
+    }
+    free(leaks);
 }
 
 /*
  * Searches the list of nodes for active blocks of memory 
  * that can cause memory leak, and prints them on screen.
+ * When call stacks are captured, leaks are then aggregated by stack.
+ * When sampling, only sampled blocks are listed, followed by an
+ * estimate of all leaked objects and bytes. With a top-K set by
+ * m61_set_leak_report_sites, leaks are aggregated by site instead.
  */
 void m61_printleakreport(void) {
+    double nobjects = 0, nbytes = 0;
+    size_t nsamples = 0;
+
+    size_t top = __atomic_load_n(&leak_report_sites, __ATOMIC_RELAXED);
+    if (top != 0){
+        m61_print_leaked_sites(top);
+        return;
+    }
+
+    pthread_mutex_lock(&meta_lock);
     if(head != NULL)
     {
         struct m61_node * current = head;
         
         while(current != NULL)
         {
-            if(current->status == MEM_ALLOC)
-                printf("LEAK CHECK: %s:%d: allocated object %p with size %d\n", current -> file, current -> line, current -> pointer, current -> size);
+            if(current->status == MEM_ALLOC){
+                printf("LEAK CHECK: %s:%d: allocated object %p with size %zu\n", current -> file, current -> line, current -> pointer, current -> size);
+                nsamples += 1;
+                nobjects += current->weight;
+                nbytes += current->weight * current->size;
+            }
 
             current = current -> next;
         }
     }
+    if (nstacks != 0){
+        m61_print_leaked_stacks();
+    }
+    pthread_mutex_unlock(&meta_lock);
+
+    if (__atomic_load_n(&sample_rate, __ATOMIC_RELAXED) != 0){
+        printf("LEAK CHECK: %zu sampled objects, estimated %.0f objects and %.0f bytes leaked\n",
+               nsamples, nobjects, nbytes);
+    }
+}
+
+/* Merged estimate for one site, used while printing the heavy-hitter report */
+struct m61_hh_estimate {
+    const char* file;
+    int line;
+    unsigned long long count;           // upper bound of the site's weight
+    unsigned long long error;           // count minus lower bound
+};
+
+static int m61_hh_compare(const void* a, const void* b){
+    const struct m61_hh_estimate * x = a;
+    const struct m61_hh_estimate * y = b;
+    return (x->count < y->count) - (x->count > y->count);
+}
+
+/*
+ * Merges one sketch per heap (selected by offset) into estimates sorted
+ * by decreasing count.
+ *
+ * A site missing from a full sketch may still have up to that sketch's
+ * minimum count there, so that minimum is added to its count and error.
+ *
+ * @param offset - offset of the sketch inside struct m61_heap
+ * @param nestimates_out - receives the number of estimates
+ * @param total_out - receives the total weight of the sketches
+ * @return estimates - calloc'd array, to be freed by the caller, or NULL (and no
+ *         estimates) if memory ran out
+ */
+static struct m61_hh_estimate * m61_hh_merge(size_t offset, size_t* nestimates_out, unsigned long long* total_out){
+    size_t nheaps = 0;
+    for (struct m61_heap * heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        nheaps += 1;
+    }
+    struct m61_hh_estimate * estimates = calloc(nheaps * M61_HH_COUNTERS + 1, sizeof(struct m61_hh_estimate));
+    size_t nestimates = 0;
+    unsigned long long total = 0, missing = 0;
+    if (estimates == NULL){
+        *nestimates_out = 0;
+        *total_out = 0;
+        return NULL;
+    }
+
+    //First pass: sum of the minimum counts of all full sketches
+    for (struct m61_heap * heap = heaps; heap != NULL; heap = heap->next){
+        struct m61_hh_sketch * sketch = (struct m61_hh_sketch*) ((char*) heap + offset);
+        total += sketch->total;
+        if (sketch->ncounters == M61_HH_COUNTERS){
+            missing += sketch->counters[sketch->heap[0]].count;
+        }
+    }
+
+    //Second pass: union of the sites, replacing the assumed minimum of
+    //each sketch that does track the site with its real counter
+    for (struct m61_heap * heap = heaps; heap != NULL; heap = heap->next){
+        struct m61_hh_sketch * sketch = (struct m61_hh_sketch*) ((char*) heap + offset);
+        unsigned long long min = sketch->ncounters == M61_HH_COUNTERS ? sketch->counters[sketch->heap[0]].count : 0;
+        for (int i = 0; i < sketch->ncounters; i++){
+            struct m61_hh_counter * counter = &sketch->counters[i];
+            size_t j = 0;
+            while (j < nestimates && (estimates[j].file != counter->file || estimates[j].line != counter->line)){
+                j++;
+            }
+            if (j == nestimates){
+                estimates[j].file = counter->file;
+                estimates[j].line = counter->line;
+                estimates[j].count = missing;
+                estimates[j].error = missing;
+                nestimates += 1;
+            }
+            estimates[j].count += counter->count - min;
+            estimates[j].error += counter->error - min;
+        }
+    }
+
+    qsort(estimates, nestimates, sizeof(struct m61_hh_estimate), m61_hh_compare);
+    *nestimates_out = nestimates;
+    *total_out = total;
+    return estimates;
+}
+
+/*
+ * Prints the sites of one merged sketch (selected by offset) whose
+ * estimated share is at least M61_HH_THRESHOLD percent.
+ *
+ * @param offset - offset of the sketch inside struct m61_heap
+ * @param unit - unit printed after each count
+ */
+static void m61_print_hh_sketch(size_t offset, const char* unit){
+    size_t nestimates;
+    unsigned long long total;
+    struct m61_hh_estimate * estimates = m61_hh_merge(offset, &nestimates, &total);
+    for (size_t j = 0; j < nestimates && total > 0; j++){
+        double share = 100.0 * estimates[j].count / total;
+        if (share < M61_HH_THRESHOLD){
+            break;
+        }
+        printf("HEAVY HITTER: %s:%d: %llu %s (~%.1f%%), error <= %llu\n", estimates[j].file, estimates[j].line,
+               estimates[j].count, unit, share, estimates[j].error);
+    }
+    free(estimates);
+}
+
+/*
+ * Prints the allocation sites responsible for at least M61_HH_THRESHOLD
+ * percent of the bytes allocated, then of the number of allocations.
+ * Counts are upper bounds; the true value is at least count - error.
+ */
+void m61_print_hh_report(void) {
+    m61_print_hh_sketch(offsetof(struct m61_heap, hh_bytes), "bytes");
+    m61_print_hh_sketch(offsetof(struct m61_heap, hh_count), "allocations");
+}
+
+/*
+ * Prints one histogram as a JSON array of [lowest value, count] pairs,
+ * skipping empty buckets.
+ *
+ * @param out - output stream
+ * @param hist - M61_HIST_BUCKETS counters
+ */
+static void m61_print_histogram(FILE* out, unsigned long long* hist){
+    const char* separator = "";
+    fprintf(out, "[");
+    for (int i = 0; i < M61_HIST_BUCKETS; i++){
+        if (hist[i] != 0){
+            fprintf(out, "%s[%llu, %llu]", separator, i ? 1ULL << (i - 1) : 0ULL, hist[i]);
+            separator = ", ";
+        }
+    }
+    fprintf(out, "]");
 }
 
+static int m61_site_compare(const void* a, const void* b){
+    const struct m61_site * x = a;
+    const struct m61_site * y = b;
+    if (x->nbytes != y->nbytes){
+        return (x->nbytes < y->nbytes) - (x->nbytes > y->nbytes);
+    }
+    return x->line - y->line;
+}
+
+/*
+ * Merges the site tables of every thread and prints them as JSON, one
+ * site per line, sites with the most bytes allocated first. Tables are
+ * read without stopping their owners, like m61_getstatistics does.
+ *
+ * @param out - output stream
+ */
+void m61_print_site_histograms(FILE* out) {
+    size_t nsites = 0;
+    for (struct m61_heap * heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        nsites += M61_SITES;
+    }
+    struct m61_site * merged = calloc(nsites + 1, sizeof(struct m61_site));
+    assert(merged != NULL);
+    size_t nmerged = 0;
+
+    for (struct m61_heap * heap = __atomic_load_n(&heaps, __ATOMIC_ACQUIRE); heap != NULL; heap = heap->next){
+        struct m61_site * sites = __atomic_load_n(&heap->sites, __ATOMIC_ACQUIRE);
+        for (int i = 0; sites != NULL && i < M61_SITES; i++){
+            const char* file = __atomic_load_n(&sites[i].file, __ATOMIC_ACQUIRE);
+            if (file == NULL){
+                continue;
+            }
+            //Threads share sites; a linear merge is fine for a report
+            size_t j = 0;
+            while (j < nmerged && (merged[j].file != file || merged[j].line != sites[i].line)){
+                j++;
+            }
+            if (j == nmerged){
+                merged[j].file = file;
+                merged[j].line = sites[i].line;
+                nmerged += 1;
+            }
+            merged[j].nallocs += __atomic_load_n(&sites[i].nallocs, __ATOMIC_RELAXED);
+            merged[j].nbytes += __atomic_load_n(&sites[i].nbytes, __ATOMIC_RELAXED);
+            merged[j].nfrees += __atomic_load_n(&sites[i].nfrees, __ATOMIC_RELAXED);
+            for (int k = 0; k < M61_HIST_BUCKETS; k++){
+                merged[j].size_hist[k] += __atomic_load_n(&sites[i].size_hist[k], __ATOMIC_RELAXED);
+                merged[j].lifetime_hist[k] += __atomic_load_n(&sites[i].lifetime_hist[k], __ATOMIC_RELAXED);
+            }
+        }
+    }
+    qsort(merged, nmerged, sizeof(struct m61_site), m61_site_compare);
+
+    fprintf(out, "{\"sites\": [\n");
+    for (size_t j = 0; j < nmerged; j++){
+        fprintf(out, "  {\"file\": \"%s\", \"line\": %d, \"allocs\": %llu, \"bytes\": %llu, \"frees\": %llu, \"sizes\": ",
+                merged[j].file, merged[j].line, merged[j].nallocs, merged[j].nbytes, merged[j].nfrees);
+        m61_print_histogram(out, merged[j].size_hist);
+        fprintf(out, ", \"lifetimes\": ");
+        m61_print_histogram(out, merged[j].lifetime_hist);
+        fprintf(out, "}%s\n", j + 1 < nmerged ? "," : "");
+    }
+    fprintf(out, "]}\n");
+    free(merged);
+}
+
+/*
+ * Publishes the merged counters and the hottest sites to the statistics
+ * segment, unless it was updated less than M61_SHM_INTERVAL ago or another
+ * thread is publishing.
+ */
+static void m61_shm_publish(void) {
+    struct m61_shm * segment = __atomic_load_n(&shm, __ATOMIC_ACQUIRE);
+    if (segment == NULL){
+        return;
+    }
+    unsigned long long now = m61_now();
+    if (segment->time != 0 && now - segment->time < M61_SHM_INTERVAL){
+        return;
+    }
+    if (__atomic_exchange_n(&shm_writing, TRUE, __ATOMIC_ACQUIRE)){
+        return;
+    }
+
+    //Everything is gathered before the segment is marked as being written
+    struct m61_statistics stats;
+    m61_getstatistics(&stats);
+    size_t nbytes, ncounts;
+    unsigned long long total;
+    struct m61_hh_estimate * bytes = m61_hh_merge(offsetof(struct m61_heap, hh_bytes), &nbytes, &total);
+    struct m61_hh_estimate * counts = m61_hh_merge(offsetof(struct m61_heap, hh_count), &ncounts, &total);
+    //Out of memory for the merge: this publish is skipped, a later one catches up
+    if (bytes == NULL || counts == NULL){
+        __atomic_store_n(&shm_writing, FALSE, __ATOMIC_RELEASE);
+        free(bytes);
+        free(counts);
+        return;
+    }
+
+    unsigned seq = segment->seq;
+    __atomic_store_n(&segment->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
 
+    segment->time = now;
+    segment->stats = stats;
+    segment->nsites = nbytes < M61_SHM_SITES ? (int) nbytes : M61_SHM_SITES;
+    for (int i = 0; i < segment->nsites; i++){
+        struct m61_shm_site * site = &segment->sites[i];
+        snprintf(site->file, sizeof(site->file), "%s", bytes[i].file != NULL ? bytes[i].file : "?");
+        site->line = bytes[i].line;
+        site->bytes = bytes[i].count;
+        site->count = 0;
+        for (size_t j = 0; j < ncounts; j++){
+            if (counts[j].file == bytes[i].file && counts[j].line == bytes[i].line){
+                site->count = counts[j].count;
+                break;
+            }
+        }
+    }
+
+    __atomic_store_n(&segment->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm_writing, FALSE, __ATOMIC_RELEASE);
+    free(bytes);
+    free(counts);
+}
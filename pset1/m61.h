@@ -1,21 +1,92 @@
 #ifndef M61_H
 #define M61_H 1
 #include <stdlib.h>
+#include <stdio.h>
 
 #define TRUE 1       
 #define FALSE 0
 
+/* Checking level, chosen at compile time (make LEVEL=N). Each level keeps
+ * the bookkeeping of the levels below it and compiles out the rest:
+ *   0 - fast path only: blocks carry their header and nothing else is kept
+ *   1 - statistics counters, sampled heavy-hitter sites, site histograms,
+ *       trace and shared-memory export
+ *   2 - verification chars and invalid, double and wild free checks
+ *   3 - nodes: leak report, quarantine, interior-pointer diagnostics and
+ *       call stacks (default)
+ */
+#ifndef M61_LEVEL
+#define M61_LEVEL 3
+#endif
+#define M61_STATS (M61_LEVEL >= 1)
+#define M61_CHECKS (M61_LEVEL >= 2)
+
 #define END_OF_BLOCK '\123'             /* Arbitrary value included at end of memory block. Used to verify wild write errors. */
-#define NUM_VERIFICATION_CHARS 2        /* Number of verification characters appended on memory blocks */
+#define NUM_VERIFICATION_CHARS (M61_CHECKS ? 2 : 0) /* Number of verification characters appended on memory blocks */
+
+#define M61_HEADER_MAGIC 0x6d363121U    /* Header magic ("m61!"), mixed with the header address */
+#define M61_ALIGNMENT 16                /* Alignment of returned pointers and of block headers */
+
+/* When 0, m61 keeps no m61_node per allocation: all metadata lives in the
+ * block header, so checks touch only the block itself. Interior-pointer
+ * diagnostics and the leak report need nodes and are unavailable. */
+#ifndef M61_TRACK_NODES
+#define M61_TRACK_NODES (M61_LEVEL >= 3)
+#endif
+#if M61_TRACK_NODES && !M61_CHECKS
+#error "M61_TRACK_NODES needs M61_LEVEL >= 2"
+#endif
+
+#define M61_CHUNK_SIZE ((size_t) 1 << 20)   /* Bytes mmap'd at once for a size class; chunks are aligned to it */
+#define M61_CHUNK_HEADER_SIZE 4096      /* Bytes reserved for chunk metadata before the first slot */
+#define M61_NCLASSES 40                 /* Number of slab size classes */
+#define M61_MAX_SMALL 32768             /* Largest block (header + data + canary) served by slabs */
+#define M61_CLASS_LARGE -1              /* Size class of blocks served by the native allocator */
+#define M61_CLASS_GUARDED -2            /* Size class of large blocks mapped against a guard page */
+#define M61_CLASS_MAPPED -3             /* Size class of large blocks in their own mapping */
+#define M61_MMAP_THRESHOLD (128 << 10)  /* Smallest block (header + data + canary) given its own mapping */
+#define M61_CLASS_ARENA -4              /* Size class of blocks bump-allocated from an arena */
+#define M61_ARENA_CHUNK (64 << 10)      /* Smallest chunk mapped by an arena */
+#define M61_CLASS_ALIGNED -5            /* Size class of over-aligned blocks carved from an enclosing block */
+#define M61_CLASS_POOL -6               /* Size class of objects of an m61_pool */
+#define M61_POOL_CHUNK (64 << 10)       /* Smallest chunk mapped by a pool */
+#define M61_CACHE_LINE 64               /* Alignment of pool objects */
+#define M61_POOL_CACHES 4               /* Pools each thread caches free slots of at once */
+#define M61_POOL_CACHE_MAX 256          /* Free slots a thread keeps per pool; more go back to the pool */
+#define M61_POOL_BATCH 32               /* Slots carved from a chunk at each refill of a thread's cache */
+#define M61_PAGE_SHIFT 12               /* Granularity of the page-ownership bitmap (4 KiB) */
+#define M61_PAGE_LEAF_SHIFT 30          /* Address span of one bitmap leaf (1 GiB) */
+#define M61_PAGE_LEAF_WORDS (((size_t) 1 << (M61_PAGE_LEAF_SHIFT - M61_PAGE_SHIFT)) / (sizeof(unsigned long) * 8))
+#define M61_GRANULE_SHIFT 4             /* Granularity of the shadow bitmap of block starts (M61_ALIGNMENT) */
+#define M61_SHADOW_LEAF_WORDS (((size_t) 1 << (M61_PAGE_LEAF_SHIFT - M61_GRANULE_SHIFT)) / (sizeof(unsigned long) * 8))
+
+#define M61_HH_COUNTERS 64              /* Sites tracked at once by each heavy-hitter sketch */
+#define M61_HH_INDEX_SIZE 256           /* Slots in a sketch's site index (power of 2, >= 2 * M61_HH_COUNTERS) */
+#define M61_HH_THRESHOLD 10.0           /* Minimum share (%) of bytes or allocations for a heavy hitter */
+
+#define M61_QUARANTINE_SIZE 4096        /* Freed tracked blocks kept for double/invalid free diagnostics */
+#define M61_QUARANTINE_BYTES ((size_t) 16 << 20)    /* Bytes of freed blocks the quarantine may hold */
+#define M61_NODE_BATCH 1024             /* Nodes carved at once by the node pool */
+#define M61_STACK_DEPTH 16              /* Most return addresses kept per call stack */
+#define M61_SITES 1024                  /* Sites with histograms per thread; the last slot collects the rest */
+#define M61_HIST_BUCKETS 65             /* Log2 buckets: 0, 1, 2-3, 4-7, ... up to 2^64-1 */
 
 #define MEM_ALLOC 1                     /* Node status = ALLOCATED. Means the block of memory is allocated */
 #define MEM_FREE 2                      /* Node status = FREE. Means the block of memory is free */
+#define M61_TRACE_REALLOC 3             /* Trace record op for a block resized in place */
+#define M61_TRACE_MAGIC 0x6d36317472616365ULL  /* "m61trace", first word of a trace file */
+#define M61_TRACE_RECORDS (1 << 20)     /* Default number of records in a trace ring */
+#define M61_SHM_MAGIC 0x6d3631736861726dULL    /* "m61sharm", first word of a statistics segment */
+#define M61_SHM_SITES 16                /* Hottest sites published in the statistics segment */
+#define M61_SHM_INTERVAL 100000000ULL   /* Nanoseconds between two publications */
+#define M61_SHM_CHECK 1024              /* Allocations of a thread between two clock checks */
 #define NALLOCATORS 40
 
 void* m61_malloc(size_t sz, const char* file, int line);
 void m61_free(void* ptr, const char* file, int line);
 void* m61_realloc(void* ptr, size_t sz, const char* file, int line);
 void* m61_calloc(size_t nmemb, size_t sz, const char* file, int line);
+void* m61_memalign(size_t alignment, size_t sz, const char* file, int line);
 
 struct m61_statistics {
     unsigned long long nactive;         // # active allocations
@@ -26,8 +97,82 @@ struct m61_statistics {
     unsigned long long fail_size;       // # bytes in failed alloc attempts
     char* heap_min;                     // smallest allocated addr
     char* heap_max;                     // largest allocated addr
+    unsigned long long arena_active;    // # bytes in arena allocations not yet rewound
+    unsigned long long arena_reserved;  // # bytes mapped by arenas
+    unsigned long long reserved;        // # bytes obtained from the OS or the native allocator
+    unsigned long long metadata;        // # bytes of headers, verification chars, nodes and node index
+};
+
+struct m61_arena;
+struct m61_pool;
+struct m61_arena_chunk;
+
+/* Allocation point of an arena, returned by m61_arena_mark */
+struct m61_arena_mark {
+    struct m61_arena_chunk * chunk;     // chunk being carved
+    char* bump;                         // next free byte in the chunk
+    size_t active;                      // bytes allocated from the arena
+};
+
+/* Hot site in the statistics segment; counts are heavy-hitter estimates */
+struct m61_shm_site {
+    char file[64];                      // file name of the site (truncated)
+    int line;                           // line number of the site
+    unsigned long long bytes;           // estimated bytes allocated
+    unsigned long long count;           // estimated number of allocations
+};
+
+/* POSIX shared-memory segment "/m61.<pid>" published by m61 (M61_SHM=1)
+ *
+ * Written with seqlock semantics: seq is odd while an update is in
+ * progress, so a reader retries until it copied the segment with the same
+ * even seq before and after. Read it with m61top.
+ */
+struct m61_shm {
+    unsigned long long magic;           // M61_SHM_MAGIC
+    unsigned seq;                       // seqlock counter
+    int pid;                            // process publishing the segment
+    unsigned long long time;            // CLOCK_MONOTONIC nanoseconds of the update
+    struct m61_statistics stats;        // merged counters
+    int nsites;                         // entries used in sites
+    struct m61_shm_site sites[M61_SHM_SITES];   // hottest sites by bytes
+};
+
+/* Boundary tag stored immediately before every block handed out by m61
+ *
+ * Layout of a block: [struct m61_header][user data][verification chars]
+ */
+struct m61_header {
+    size_t size;                        // size of allocated memory in bytes
+    const char* file;                   // file name that allocated memory
+    int line;                           // file line number that allocated memory
+    int status;                         // status (MEM_ALLOC or MEM_FREE)
+    unsigned magic;                     // M61_HEADER_MAGIC ^ header address, detects invalid pointers
+    int sclass;                         // size class of the slab slot, or M61_CLASS_LARGE
+    struct m61_node * node;             // node tracking this block (NULL if M61_TRACK_NODES is 0)
+    unsigned long long seq;             // allocation sequence number (0 if histograms are off)
+};
+
+/* Header of a trace file, followed by its ring of records */
+struct m61_trace_header {
+    unsigned long long magic;           // M61_TRACE_MAGIC
+    unsigned long long capacity;        // number of record slots in the ring
+    unsigned long long count;           // records ever written; the last capacity survive
 };
 
+/* One allocator event in a trace file; record i lives in slot i % capacity */
+struct m61_trace_record {
+    unsigned long long time;            // nanoseconds since the trace started
+    unsigned long long pointer;         // block allocated, resized or freed
+    unsigned long long old_pointer;     // block before a resize (0 otherwise)
+    unsigned long long size;            // size requested (0 for frees)
+    unsigned site;                      // hash of the caller's file:line
+    unsigned op;                        // MEM_ALLOC, MEM_FREE or M61_TRACE_REALLOC (0 = being written)
+};
+
+/* Header size rounded up so user data stays M61_ALIGNMENT-aligned */
+#define M61_HEADER_SIZE ((sizeof(struct m61_header) + M61_ALIGNMENT - 1) & ~(size_t) (M61_ALIGNMENT - 1))
+
 /* Linked list of memory allocation information */
 struct m61_node {
     int is_valid;                       // specifies if node was overriden by external sources
@@ -36,10 +181,15 @@ struct m61_node {
     int status;                         // status (MEM_ALLOC or MEM_FREE)
     char* file;                         // file name that allocated memory
     int line;                           // file line number that allocated memory
+    double weight;                      // allocations this node stands for (1 unless sampling)
+    unsigned stack;                     // call stack id in the stack table (0 = not captured)
     struct m61_node * next;             // reference to next node
     struct m61_node * prev;             // reference to previous node
 };
 
+struct m61_header * m61_get_header(void* ptr);
+int m61_check_header(struct m61_header* header);
+
 size_t m61_get_pointer_size(void* ptr);
 int m61_check_pointer_status (void *ptr, int status);
 int m61_check_pointer_in_heap (void *ptr);
@@ -51,9 +201,32 @@ void m61_append_verification_chars(char* data, size_t sz);
 struct m61_node * m61_find_node(void *ptr);
 struct m61_node * m61_find_node_with_closest_pointer(void* ptr);
 
+void m61_set_sample_rate(size_t rate);
+void m61_set_guard_pages(int enabled);
+void m61_set_stack_depth(int depth);
+int m61_set_trace_file(const char* path, size_t capacity);
+void m61_set_site_histograms(int enabled);
+int m61_set_shm_export(int enabled);
+void m61_set_footprint_report(int enabled);
+void m61_set_leak_report_sites(size_t top);
+
+struct m61_arena * m61_arena_create(void);
+void* m61_arena_alloc(struct m61_arena* arena, size_t sz, const char* file, int line);
+struct m61_arena_mark m61_arena_mark(struct m61_arena* arena);
+void m61_arena_rewind(struct m61_arena* arena, struct m61_arena_mark mark);
+void m61_arena_destroy(struct m61_arena* arena);
+struct m61_arena * m61_set_current_arena(struct m61_arena* arena);
+
+struct m61_pool * m61_pool_create(size_t object_size);
+void* m61_pool_alloc(struct m61_pool* pool, const char* file, int line);
+void m61_pool_free(struct m61_pool* pool, void* ptr, const char* file, int line);
+void m61_pool_destroy(struct m61_pool* pool);
+
 void m61_getstatistics(struct m61_statistics* stats);
 void m61_printstatistics(void);
 void m61_printleakreport(void);
+void m61_print_hh_report(void);
+void m61_print_site_histograms(FILE* out);
 
 #if !M61_DISABLE
 #define malloc(sz)              m61_malloc((sz), __FILE__, __LINE__)
@@ -0,0 +1,373 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+// m61bench: runs standard allocation patterns against m61 or the native
+// allocator and prints one key=value line per pattern: time per operation,
+// peak RSS, and the share of that RSS which is not live data.
+//
+//     m61bench [-a m61|glibc] [-n OPERATIONS] [PATTERN...]
+//
+// Patterns: lifo fifo random prodcon realloc sites pool (default: all).
+// Each one runs in a child process, so peak RSS is measured per pattern.
+
+#define BENCH_BATCH 1000                /* Blocks alive at once in lifo and fifo */
+#define BENCH_WINDOW 10000              /* Blocks alive at once in random and sites */
+#define BENCH_QUEUE 4096                /* Blocks in flight between producer and consumer */
+#define BENCH_SITES 64                  /* Allocation sites in the sites pattern */
+#define BENCH_THREADS 4                 /* Threads sharing the pool in the pool pattern */
+#define BENCH_OBJECT 64                 /* Object size in the pool pattern */
+
+int use_m61 = 1;
+unsigned long long nops = 1000000;      // operations per pattern (mallocs + frees + reallocs)
+
+/* Bytes requested by live blocks, and their peak; atomic for prodcon */
+unsigned long long live = 0;
+unsigned long long peak_live = 0;
+
+static void* bench_malloc(size_t sz, int line){
+    return use_m61 ? m61_malloc(sz, __FILE__, line) : malloc(sz);
+}
+
+static void* bench_realloc(void* ptr, size_t sz){
+    return use_m61 ? m61_realloc(ptr, sz, __FILE__, __LINE__) : realloc(ptr, sz);
+}
+
+static void bench_free(void* ptr){
+    if (use_m61){
+        m61_free(ptr, __FILE__, __LINE__);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+static void bench_live_add(unsigned long long delta){
+    unsigned long long now = __atomic_add_fetch(&live, delta, __ATOMIC_RELAXED);
+    unsigned long long peak = __atomic_load_n(&peak_live, __ATOMIC_RELAXED);
+    while (now > peak && !__atomic_compare_exchange_n(&peak_live, &peak, now, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+    }
+}
+
+/**
+ * Returns the next number of a xorshift sequence; patterns are deterministic.
+ *
+ * @param state - generator state (not 0)
+ * @return value - pseudo-random 64-bit value
+ */
+static unsigned long long bench_random(unsigned long long* state){
+    unsigned long long x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/**
+ * Returns a block size between 16 and 527 bytes, small sizes most often.
+ *
+ * @param state - generator state
+ * @return size - number of bytes
+ */
+static size_t bench_size(unsigned long long* state){
+    unsigned long long r = bench_random(state);
+    return 16 + ((r & 511) * ((r >> 9) & 511) >> 9);
+}
+
+/* Allocates a batch and frees it newest first */
+static unsigned long long pattern_lifo(void){
+    void* blocks[BENCH_BATCH];
+    size_t sizes[BENCH_BATCH];
+    unsigned long long state = 88172645463325252ULL, done = 0;
+    while (done < nops){
+        for (int i = 0; i < BENCH_BATCH; i++){
+            sizes[i] = bench_size(&state);
+            blocks[i] = bench_malloc(sizes[i], __LINE__);
+            bench_live_add(sizes[i]);
+        }
+        for (int i = BENCH_BATCH - 1; i >= 0; i--){
+            bench_free(blocks[i]);
+            bench_live_add(-(unsigned long long) sizes[i]);
+        }
+        done += 2 * BENCH_BATCH;
+    }
+    return done;
+}
+
+/* Allocates a batch and frees it oldest first */
+static unsigned long long pattern_fifo(void){
+    void* blocks[BENCH_BATCH];
+    size_t sizes[BENCH_BATCH];
+    unsigned long long state = 88172645463325252ULL, done = 0;
+    while (done < nops){
+        for (int i = 0; i < BENCH_BATCH; i++){
+            sizes[i] = bench_size(&state);
+            blocks[i] = bench_malloc(sizes[i], __LINE__);
+            bench_live_add(sizes[i]);
+        }
+        for (int i = 0; i < BENCH_BATCH; i++){
+            bench_free(blocks[i]);
+            bench_live_add(-(unsigned long long) sizes[i]);
+        }
+        done += 2 * BENCH_BATCH;
+    }
+    return done;
+}
+
+/**
+ * Keeps a window of blocks and replaces a random one at each step, so
+ * lifetimes are random. With sites, the replacement is allocated from
+ * one of BENCH_SITES lines, a few of which make most allocations, as in
+ * hhtest.
+ *
+ * @param sites - TRUE to spread allocations over skewed sites
+ * @return ops - operations done
+ */
+static unsigned long long pattern_window(int sites){
+    void** blocks = calloc(BENCH_WINDOW, sizeof(void*));
+    size_t* sizes = calloc(BENCH_WINDOW, sizeof(size_t));
+    unsigned long long state = 88172645463325252ULL, done = 0;
+    while (done < nops){
+        unsigned long long r = bench_random(&state);
+        size_t slot = r % BENCH_WINDOW;
+        if (blocks[slot] != NULL){
+            bench_free(blocks[slot]);
+            bench_live_add(-(unsigned long long) sizes[slot]);
+            done += 1;
+        }
+        sizes[slot] = bench_size(&state);
+        int line = __LINE__;
+        if (sites){
+            //Cubing a uniform value skews it towards site 0
+            double u = (double) (r >> 11) / (double) (1ULL << 53);
+            line = 1000 + (int) (BENCH_SITES * u * u * u);
+        }
+        blocks[slot] = bench_malloc(sizes[slot], line);
+        bench_live_add(sizes[slot]);
+        done += 1;
+    }
+    for (size_t i = 0; i < BENCH_WINDOW; i++){
+        if (blocks[i] != NULL){
+            bench_free(blocks[i]);
+            bench_live_add(-(unsigned long long) sizes[i]);
+        }
+    }
+    free(blocks);
+    free(sizes);
+    return done;
+}
+
+static unsigned long long pattern_random(void){
+    return pattern_window(FALSE);
+}
+
+static unsigned long long pattern_sites(void){
+    return pattern_window(TRUE);
+}
+
+/* Single-producer single-consumer ring of blocks */
+struct bench_queue {
+    void* blocks[BENCH_QUEUE];
+    size_t sizes[BENCH_QUEUE];
+    unsigned long long head;            // next slot the consumer reads
+    unsigned long long tail;            // next slot the producer writes
+};
+
+static void* consumer(void* arg){
+    struct bench_queue * queue = arg;
+    for (unsigned long long i = 0; i < nops / 2; i++){
+        while (__atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) == i){
+            sched_yield();
+        }
+        bench_free(queue->blocks[i % BENCH_QUEUE]);
+        bench_live_add(-(unsigned long long) queue->sizes[i % BENCH_QUEUE]);
+        __atomic_store_n(&queue->head, i + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/* One thread allocates, another frees what it allocated */
+static unsigned long long pattern_prodcon(void){
+    struct bench_queue * queue = calloc(1, sizeof(struct bench_queue));
+    unsigned long long state = 88172645463325252ULL;
+    pthread_t thread;
+    pthread_create(&thread, NULL, consumer, queue);
+    for (unsigned long long i = 0; i < nops / 2; i++){
+        while (i - __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == BENCH_QUEUE){
+            sched_yield();
+        }
+        queue->sizes[i % BENCH_QUEUE] = bench_size(&state);
+        queue->blocks[i % BENCH_QUEUE] = bench_malloc(queue->sizes[i % BENCH_QUEUE], __LINE__);
+        bench_live_add(queue->sizes[i % BENCH_QUEUE]);
+        __atomic_store_n(&queue->tail, i + 1, __ATOMIC_RELEASE);
+    }
+    pthread_join(thread, NULL);
+    free(queue);
+    return nops / 2 * 2;
+}
+
+/* Grows buffers from nothing to 64 KiB, a few bytes at a time */
+static unsigned long long pattern_realloc(void){
+    unsigned long long state = 88172645463325252ULL, done = 0;
+    while (done < nops){
+        char* buffer = NULL;
+        size_t size = 0;
+        while (size < 65536 && done < nops){
+            size_t grown = size + 1 + (bench_random(&state) & 63);
+            buffer = bench_realloc(buffer, grown);
+            buffer[grown - 1] = 1;
+            bench_live_add(grown - size);
+            size = grown;
+            done += 1;
+        }
+        bench_free(buffer);
+        bench_live_add(-(unsigned long long) size);
+        done += 1;
+    }
+    return done;
+}
+
+/* Pool shared by the threads of the pool pattern (m61 only) */
+struct m61_pool* bench_pool;
+
+static void* pool_worker(void* arg){
+    (void) arg;
+    void* blocks[BENCH_BATCH];
+    for (unsigned long long done = 0; done < nops / BENCH_THREADS; done += 2 * BENCH_BATCH){
+        for (int i = 0; i < BENCH_BATCH; i++){
+            blocks[i] = use_m61 ? m61_pool_alloc(bench_pool, __FILE__, __LINE__) : malloc(BENCH_OBJECT);
+            bench_live_add(BENCH_OBJECT);
+        }
+        for (int i = 0; i < BENCH_BATCH; i++){
+            if (use_m61){
+                m61_pool_free(bench_pool, blocks[i], __FILE__, __LINE__);
+            }
+            else {
+                free(blocks[i]);
+            }
+            bench_live_add(-(unsigned long long) BENCH_OBJECT);
+        }
+    }
+    return NULL;
+}
+
+/* Threads allocate and free fixed-size objects of one shared pool
+ * (malloc for glibc) */
+static unsigned long long pattern_pool(void){
+    bench_pool = use_m61 ? m61_pool_create(BENCH_OBJECT) : NULL;
+    pthread_t threads[BENCH_THREADS];
+    for (int i = 0; i < BENCH_THREADS; i++){
+        pthread_create(&threads[i], NULL, pool_worker, NULL);
+    }
+    for (int i = 0; i < BENCH_THREADS; i++){
+        pthread_join(threads[i], NULL);
+    }
+    if (use_m61){
+        m61_pool_destroy(bench_pool);
+    }
+    //Each thread runs whole batches until it has done its share
+    unsigned long long batches = (nops / BENCH_THREADS + 2 * BENCH_BATCH - 1) / (2 * BENCH_BATCH);
+    return batches * 2 * BENCH_BATCH * BENCH_THREADS;
+}
+
+struct bench_pattern {
+    const char* name;
+    unsigned long long (*run)(void);
+};
+
+struct bench_pattern patterns[] = {
+    { "lifo", pattern_lifo },
+    { "fifo", pattern_fifo },
+    { "random", pattern_random },
+    { "prodcon", pattern_prodcon },
+    { "realloc", pattern_realloc },
+    { "sites", pattern_sites },
+    { "pool", pattern_pool },
+};
+#define NPATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+/**
+ * Runs a pattern in a child process and prints its results.
+ *
+ * @param pattern - pattern to run
+ * @return status - 0 on success
+ */
+static int bench_run(struct bench_pattern* pattern){
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0){
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        long base_rss = usage.ru_maxrss;
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        unsigned long long done = pattern->run();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        getrusage(RUSAGE_SELF, &usage);
+        double ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        double used = (double) (usage.ru_maxrss - base_rss) * 1024;
+        double overhead = used > peak_live ? 1 - peak_live / used : 0;
+        printf("allocator=%s pattern=%s ops=%llu ns_per_op=%.1f peak_rss_kb=%ld peak_live_kb=%llu overhead=%.3f\n",
+               use_m61 ? "m61" : "glibc", pattern->name, done, done ? ns / done : 0,
+               usage.ru_maxrss - base_rss, peak_live / 1024, overhead);
+        fflush(stdout);
+        _exit(0);
+    }
+    int status;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0){
+        fprintf(stderr, "m61bench: pattern %s failed\n", pattern->name);
+        return 1;
+    }
+    return 0;
+}
+
+static void usage(void){
+    fprintf(stderr, "Usage: m61bench [-a m61|glibc] [-n OPERATIONS] [PATTERN...]\n");
+    exit(1);
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "a:n:")) != -1){
+        if (opt == 'a' && (strcmp(optarg, "m61") == 0 || strcmp(optarg, "glibc") == 0)){
+            use_m61 = strcmp(optarg, "m61") == 0;
+        }
+        else if (opt == 'n' && strtoull(optarg, NULL, 0) > 0){
+            nops = strtoull(optarg, NULL, 0);
+        }
+        else {
+            usage();
+        }
+    }
+
+    for (int j = optind; j < argc; j++){
+        int known = FALSE;
+        for (size_t i = 0; i < NPATTERNS; i++){
+            known |= strcmp(argv[j], patterns[i].name) == 0;
+        }
+        if (!known){
+            usage();
+        }
+    }
+
+    int status = 0;
+    for (size_t i = 0; i < NPATTERNS; i++){
+        int selected = optind == argc;
+        for (int j = optind; j < argc; j++){
+            selected |= strcmp(argv[j], patterns[i].name) == 0;
+        }
+        if (selected){
+            status |= bench_run(&patterns[i]);
+        }
+    }
+    return status;
+}
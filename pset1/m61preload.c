@@ -0,0 +1,195 @@
+#define M61_DISABLE 1
+#define _GNU_SOURCE
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+// libm61.so: m61 for unmodified programs. Interposes the C library's
+// allocator, so every allocation of the program goes through m61, and
+// prints the statistics and the leak report on stderr at exit.
+//
+//     LD_PRELOAD=./libm61.so PROGRAM [ARGS...]
+//
+// The M61_* environment variables configure it as usual. Blocks are
+// attributed to the return address of the malloc call; M61_STACKS=N also
+// records the call stacks.
+
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t nmemb, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void __libc_free(void* ptr);
+void* __libc_memalign(size_t alignment, size_t size);
+
+#define M61_PRELOAD_SITES 4096          /* Return addresses named at once (power of 2) */
+
+/* Set while the calling thread is inside m61. Allocations made meanwhile
+ * (by the C library on behalf of m61, e.g. stdio buffers or the unwinder)
+ * go to the C library's allocator; free and realloc tell the two kinds of
+ * blocks apart by heap membership.
+ */
+static __thread int busy = 0;
+
+/* Return addresses used as file names, so sites and reports tell the
+ * callers apart. A slot is claimed with CAS and then named; it is never
+ * released, so the name pointer stays a stable site key.
+ */
+static uintptr_t site_addresses[M61_PRELOAD_SITES];
+static char site_names[M61_PRELOAD_SITES][2 + 2 * sizeof(uintptr_t) + 1];
+
+/**
+ * Returns the file name standing for a return address.
+ *
+ * @param address - return address of the malloc call
+ * @return file - "0x..." name of the address, or "(other sites)" once the table is full
+ */
+static const char* m61_preload_site(void* address){
+    uintptr_t key = (uintptr_t) address;
+    size_t slot = (size_t) ((key >> 2) * (uintptr_t) 0x9E3779B97F4A7C15ULL) & (M61_PRELOAD_SITES - 1);
+    for (int probes = 0; probes < M61_PRELOAD_SITES; probes++){
+        uintptr_t current = __atomic_load_n(&site_addresses[slot], __ATOMIC_ACQUIRE);
+        if (current == key){
+            return site_names[slot];
+        }
+        if (current == 0 && __atomic_compare_exchange_n(&site_addresses[slot], &current, key, 0,
+                                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+            snprintf(site_names[slot], sizeof(site_names[slot]), "%#" PRIxPTR, key);
+            return site_names[slot];
+        }
+        if (current == key){
+            return site_names[slot];
+        }
+        slot = (slot + 1) & (M61_PRELOAD_SITES - 1);
+    }
+    return "(other sites)";
+}
+
+void* malloc(size_t size){
+    if (busy){
+        return __libc_malloc(size);
+    }
+    busy = 1;
+    void* ptr = m61_malloc(size, m61_preload_site(__builtin_return_address(0)), 0);
+    busy = 0;
+    return ptr;
+}
+
+void free(void* ptr){
+    //Blocks from before m61 took over, or allocated on its behalf, go back to the C library
+    if (ptr == NULL || !m61_check_pointer_in_heap(ptr)){
+        __libc_free(ptr);
+        return;
+    }
+    int was_busy = busy;
+    busy = 1;
+    m61_free(ptr, m61_preload_site(__builtin_return_address(0)), 0);
+    busy = was_busy;
+}
+
+void* calloc(size_t nmemb, size_t size){
+    if (busy){
+        return __libc_calloc(nmemb, size);
+    }
+    busy = 1;
+    void* ptr = m61_calloc(nmemb, size, m61_preload_site(__builtin_return_address(0)), 0);
+    busy = 0;
+    return ptr;
+}
+
+void* realloc(void* ptr, size_t size){
+    if (ptr != NULL ? !m61_check_pointer_in_heap(ptr) : busy){
+        return __libc_realloc(ptr, size);
+    }
+    int was_busy = busy;
+    busy = 1;
+    void* new_ptr = m61_realloc(ptr, size, m61_preload_site(__builtin_return_address(0)), 0);
+    busy = was_busy;
+    return new_ptr;
+}
+
+void* reallocarray(void* ptr, size_t nmemb, size_t size){
+    if (size != 0 && nmemb > (size_t) -1 / size){
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, nmemb * size);
+}
+
+void* memalign(size_t alignment, size_t size){
+    if (busy){
+        return __libc_memalign(alignment, size);
+    }
+    busy = 1;
+    void* ptr = m61_memalign(alignment, size, m61_preload_site(__builtin_return_address(0)), 0);
+    busy = 0;
+    return ptr;
+}
+
+int posix_memalign(void** memptr, size_t alignment, size_t size){
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0){
+        return EINVAL;
+    }
+    void* ptr;
+    if (busy){
+        ptr = __libc_memalign(alignment, size);
+    }
+    else {
+        busy = 1;
+        ptr = m61_memalign(alignment, size, m61_preload_site(__builtin_return_address(0)), 0);
+        busy = 0;
+    }
+    if (ptr == NULL){
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void* aligned_alloc(size_t alignment, size_t size){
+    return memalign(alignment, size);
+}
+
+void* valloc(size_t size){
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size){
+    size_t page = sysconf(_SC_PAGESIZE);
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void* ptr){
+    //Sizes of C library blocks are unknown here; 0 is the answer for NULL too
+    return ptr != NULL && m61_check_pointer_in_heap(ptr) ? m61_get_pointer_size(ptr) : 0;
+}
+
+/* Copy of stderr taken at startup, since programs may close theirs */
+static int report_fd = -1;
+
+__attribute__((constructor)) static void m61_preload_init(void){
+    report_fd = fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 3);
+}
+
+/*
+ * Prints the statistics and the leak report of the process on its
+ * startup stderr. The reports write to stdout, which is swapped for the
+ * duration, so the program's own stdout is left alone.
+ */
+__attribute__((destructor)) static void m61_preload_report(void){
+    busy = 1;
+    FILE* out = report_fd >= 0 ? fdopen(report_fd, "w") : NULL;
+    if (out != NULL){
+        FILE* saved = stdout;
+        stdout = out;
+        printf("m61: process %d\n", (int) getpid());
+        m61_printstatistics();
+        m61_printleakreport();
+        stdout = saved;
+        fclose(out);
+    }
+    busy = 0;
+}
@@ -0,0 +1,226 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+// m61replay: replays a trace recorded with M61_TRACE=<file> against m61 or
+// the native allocator, and reports throughput and memory use.
+//
+//     m61replay [-a m61|glibc] TRACEFILE
+
+/* Block of the replay, keyed by its address in the trace */
+struct replay_block {
+    unsigned long long traced;          // address in the trace (0 = empty slot)
+    void* ptr;                          // address in the replay
+    size_t size;                        // size requested
+};
+
+struct replay_block * blocks;
+size_t blocks_capacity;                 // power of 2
+int use_m61 = 1;
+
+/**
+ * Finds the slot of a traced address, or the empty slot where it belongs.
+ *
+ * @param traced - address in the trace
+ * @return block - slot for traced
+ */
+static struct replay_block * replay_find(unsigned long long traced){
+    size_t slot = (size_t) ((traced >> 4) * 0x9E3779B97F4A7C15ULL) & (blocks_capacity - 1);
+    while (blocks[slot].traced != 0 && blocks[slot].traced != traced){
+        slot = (slot + 1) & (blocks_capacity - 1);
+    }
+    return &blocks[slot];
+}
+
+/**
+ * Removes a block from the table, shifting later entries of its probe
+ * sequence back into the hole.
+ *
+ * @param block - slot to empty
+ */
+static void replay_remove(struct replay_block* block){
+    size_t mask = blocks_capacity - 1;
+    size_t hole = block - blocks;
+    for (size_t next = (hole + 1) & mask; blocks[next].traced != 0; next = (next + 1) & mask){
+        size_t home = (size_t) ((blocks[next].traced >> 4) * 0x9E3779B97F4A7C15ULL) & mask;
+        if (hole <= next ? (home <= hole || home > next) : (home <= hole && home > next)){
+            blocks[hole] = blocks[next];
+            hole = next;
+        }
+    }
+    blocks[hole].traced = 0;
+}
+
+static void* replay_malloc(size_t sz){
+    return use_m61 ? m61_malloc(sz, __FILE__, __LINE__) : malloc(sz);
+}
+
+static void* replay_realloc(void* ptr, size_t sz){
+    return use_m61 ? m61_realloc(ptr, sz, __FILE__, __LINE__) : realloc(ptr, sz);
+}
+
+static void replay_free(void* ptr){
+    if (use_m61){
+        m61_free(ptr, __FILE__, __LINE__);
+    }
+    else {
+        free(ptr);
+    }
+}
+
+/**
+ * Writes one byte per page of a block, so it counts in the RSS like the
+ * traced program's data did.
+ *
+ * @param ptr - block
+ * @param size - size of the block
+ */
+static void replay_touch(char* ptr, size_t size){
+    for (size_t i = 0; i < size; i += 4096){
+        ptr[i] = 1;
+    }
+}
+
+int main(int argc, char** argv) {
+    //The replay itself must not be traced
+    unsetenv("M61_TRACE");
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:")) != -1){
+        if (opt == 'a' && (strcmp(optarg, "m61") == 0 || strcmp(optarg, "glibc") == 0)){
+            use_m61 = strcmp(optarg, "m61") == 0;
+        }
+        else {
+            fprintf(stderr, "Usage: m61replay [-a m61|glibc] TRACEFILE\n");
+            exit(1);
+        }
+    }
+    if (optind + 1 != argc){
+        fprintf(stderr, "Usage: m61replay [-a m61|glibc] TRACEFILE\n");
+        exit(1);
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(struct m61_trace_header)){
+        fprintf(stderr, "m61replay: cannot read %s\n", argv[optind]);
+        exit(1);
+    }
+    char* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    struct m61_trace_header * header = (struct m61_trace_header*) map;
+    if (map == MAP_FAILED || header->magic != M61_TRACE_MAGIC
+        || (size_t) st.st_size < sizeof(*header) + header->capacity * sizeof(struct m61_trace_record)){
+        fprintf(stderr, "m61replay: %s is not an m61 trace\n", argv[optind]);
+        exit(1);
+    }
+    struct m61_trace_record * records = (struct m61_trace_record*) (header + 1);
+
+    //Once the ring wrapped, only the last capacity records survive
+    unsigned long long first = header->count > header->capacity ? header->count - header->capacity : 0;
+    blocks_capacity = 1024;
+    while (blocks_capacity < 2 * header->capacity){
+        blocks_capacity *= 2;
+    }
+    blocks = calloc(blocks_capacity, sizeof(struct replay_block));
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long base_rss = usage.ru_maxrss;
+
+    unsigned long long nops = 0, nskipped = 0, nfailed = 0;
+    unsigned long long live = 0, peak_live = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (unsigned long long i = first; i < header->count; i++){
+        struct m61_trace_record * record = &records[i % header->capacity];
+        struct replay_block * block;
+
+        if (record->op == MEM_FREE){
+            block = replay_find(record->pointer);
+            if (block->traced == 0){
+                //Allocated before the surviving part of the ring
+                nskipped += 1;
+                continue;
+            }
+            replay_free(block->ptr);
+            live -= block->size;
+            replay_remove(block);
+        }
+        else if (record->op == M61_TRACE_REALLOC && replay_find(record->old_pointer)->traced != 0){
+            block = replay_find(record->old_pointer);
+            void* ptr = replay_realloc(block->ptr, record->size);
+            if (ptr == NULL && record->size != 0){
+                //A failed realloc leaves the block where it was
+                nfailed += 1;
+                continue;
+            }
+            struct replay_block resized = *block;
+            replay_remove(block);
+            resized.ptr = ptr;
+            if (record->size > resized.size){
+                replay_touch((char*) resized.ptr + resized.size, record->size - resized.size);
+            }
+            live += record->size - resized.size;
+            resized.traced = record->pointer;
+            resized.size = record->size;
+            *replay_find(record->pointer) = resized;
+        }
+        else if (record->op == MEM_ALLOC || record->op == M61_TRACE_REALLOC){
+            block = replay_find(record->pointer);
+            if (block->traced != 0){
+                //The free of the previous block at this address was lost
+                live -= block->size;
+            }
+            void* ptr = replay_malloc(record->size);
+            if (ptr == NULL && record->size != 0){
+                //The block is not tracked, so its free is skipped later
+                nfailed += 1;
+                if (block->traced != 0){
+                    replay_remove(block);
+                }
+                continue;
+            }
+            block->traced = record->pointer;
+            block->ptr = ptr;
+            block->size = record->size;
+            replay_touch(block->ptr, block->size);
+            live += block->size;
+        }
+        else {
+            nskipped += 1;
+            continue;
+        }
+        nops += 1;
+        if (live > peak_live){
+            peak_live = live;
+        }
+
+        //Replayed records no longer count in the RSS
+        if ((i + 1) % 4096 == 0){
+            uintptr_t done = ((uintptr_t) &records[(i + 1) % header->capacity]) & ~(uintptr_t) 4095;
+            if (done > (uintptr_t) map){
+                madvise(map, done - (uintptr_t) map, MADV_DONTNEED);
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_SELF, &usage);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    double used = (double) (usage.ru_maxrss - base_rss) * 1024;
+    double fragmentation = used > peak_live ? 1 - peak_live / used : 0;
+
+    printf("allocator=%s ops=%llu skipped=%llu failed=%llu seconds=%.3f ops_per_sec=%.0f peak_rss_kb=%ld peak_live_kb=%llu fragmentation=%.3f\n",
+           use_m61 ? "m61" : "glibc", nops, nskipped, nfailed, seconds, seconds > 0 ? nops / seconds : 0,
+           usage.ru_maxrss, peak_live / 1024, fragmentation);
+    return 0;
+}
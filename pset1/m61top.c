@@ -0,0 +1,95 @@
+#define M61_DISABLE 1
+#include "m61.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+// m61top: shows the live statistics of a process running m61 with
+// M61_SHM=1, read from its shared-memory segment without stopping it.
+//
+//     m61top [-n ITERATIONS] [-d SECONDS] PID
+
+static void usage(void) {
+    fprintf(stderr, "Usage: m61top [-n ITERATIONS] [-d SECONDS] PID\n");
+    exit(1);
+}
+
+/**
+ * Copies a consistent snapshot of the segment: retries while the
+ * publisher is writing, or if it wrote during the copy.
+ *
+ * @param segment - mapped segment
+ * @param snapshot - receives the copy
+ */
+static void read_snapshot(const struct m61_shm* segment, struct m61_shm* snapshot) {
+    unsigned before, after;
+    do {
+        before = __atomic_load_n(&segment->seq, __ATOMIC_ACQUIRE);
+        memcpy(snapshot, (const void*) segment, sizeof(*snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&segment->seq, __ATOMIC_RELAXED);
+    } while ((before & 1) != 0 || before != after);
+}
+
+int main(int argc, char** argv) {
+    long iterations = -1;
+    double delay = 1.0;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:d:")) != -1) {
+        if (opt == 'n') {
+            iterations = strtol(optarg, NULL, 0);
+        } else if (opt == 'd') {
+            delay = strtod(optarg, NULL);
+        } else {
+            usage();
+        }
+    }
+    if (optind + 1 != argc || delay <= 0) {
+        usage();
+    }
+
+    char name[32];
+    snprintf(name, sizeof(name), "/m61.%s", argv[optind]);
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "m61top: no m61 statistics for process %s (run it with M61_SHM=1)\n", argv[optind]);
+        exit(1);
+    }
+    const struct m61_shm* segment = (const struct m61_shm*) mmap(NULL, sizeof(struct m61_shm), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED || segment->magic != M61_SHM_MAGIC) {
+        fprintf(stderr, "m61top: %s is not an m61 statistics segment\n", name);
+        exit(1);
+    }
+
+    struct m61_shm previous, current;
+    read_snapshot(segment, &previous);
+    int tty = isatty(STDOUT_FILENO);
+    for (long i = 0; iterations < 0 || i < iterations; i++) {
+        usleep((useconds_t) (delay * 1e6));
+        read_snapshot(segment, &current);
+
+        //Rates come from the two latest publications
+        double seconds = (current.time - previous.time) / 1e9;
+        double rate = seconds > 0 ? (current.stats.ntotal - previous.stats.ntotal) / seconds : 0;
+        double byte_rate = seconds > 0 ? (current.stats.total_size - previous.stats.total_size) / seconds : 0;
+
+        if (tty) {
+            printf("\033[H\033[J");
+        }
+        printf("pid %d  active %llu objects, %llu bytes  alloc rate %.0f/s, %.0f bytes/s  failed %llu\n",
+               current.pid, current.stats.nactive, current.stats.active_size, rate, byte_rate, current.stats.nfail);
+        printf("%16s %12s  %s\n", "bytes", "allocations", "site");
+        for (int j = 0; j < current.nsites && j < M61_SHM_SITES; j++) {
+            printf("%16llu %12llu  %s:%d\n", current.sites[j].bytes, current.sites[j].count,
+                   current.sites[j].file, current.sites[j].line);
+        }
+        fflush(stdout);
+        if (current.time != previous.time) {
+            previous = current;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,44 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <pthread.h>
+// Concurrent allocation, with blocks freed by a different thread.
+
+#define NTHREADS 4
+#define NBLOCKS 10000
+
+static char* blocks[NTHREADS][NBLOCKS];
+
+static void* allocate(void* arg) {
+    char** mine = (char**) arg;
+    for (int i = 0; i < NBLOCKS; ++i) {
+        mine[i] = (char*) malloc(i % 100 + 1);
+        memset(mine[i], i, i % 100 + 1);
+    }
+    return NULL;
+}
+
+static void* release(void* arg) {
+    char** theirs = (char**) arg;
+    for (int i = 0; i < NBLOCKS; ++i)
+        free(theirs[i]);
+    return NULL;
+}
+
+int main() {
+    pthread_t threads[NTHREADS];
+    for (int t = 0; t < NTHREADS; ++t)
+        pthread_create(&threads[t], NULL, allocate, blocks[t]);
+    for (int t = 0; t < NTHREADS; ++t)
+        pthread_join(threads[t], NULL);
+    // each thread frees the blocks allocated by its neighbor
+    for (int t = 0; t < NTHREADS; ++t)
+        pthread_create(&threads[t], NULL, release, blocks[(t + 1) % NTHREADS]);
+    for (int t = 0; t < NTHREADS; ++t)
+        pthread_join(threads[t], NULL);
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total      40000   fail          0
+//! malloc size:  active          0   total    2020000   fail          0
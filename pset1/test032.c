@@ -0,0 +1,20 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Heavy hitter report by bytes and by number of allocations.
+
+int main() {
+    for (int i = 0; i < 1000; ++i)
+        free(malloc(100));
+    for (int i = 0; i < 3000; ++i)
+        free(malloc(10));
+    for (int i = 0; i < 100; ++i)
+        free(malloc(1));
+    m61_print_hh_report();
+}
+
+//! HEAVY HITTER: test???.c:9: 100000 bytes (~76.9%), error <= 0
+//! HEAVY HITTER: test???.c:11: 30000 bytes (~23.1%), error <= 0
+//! HEAVY HITTER: test???.c:11: 3000 allocations (~73.2%), error <= 0
+//! HEAVY HITTER: test???.c:9: 1000 allocations (~24.4%), error <= 0
@@ -0,0 +1,17 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Guard pages catch a large overrun at the faulting write.
+
+int main() {
+    m61_set_guard_pages(1);
+    char* p = (char*) malloc(40000);
+    for (int i = 0; i < 50000; ++i)
+        p[i] = 'x';   // Whoops! Overruns the block by 10000 bytes.
+    free(p);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG: test???.c:9: invalid access to ???, ??? bytes past the end of a 40000 byte region allocated here
+//! ???
@@ -0,0 +1,36 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Realloc growing one byte at a time, into a large block and back.
+
+int main() {
+    //Growing within the slack of its slot keeps the block where it is
+    char* q = (char*) malloc(20);
+    char* grown = (char*) realloc(q, 24);
+    assert(grown == q);
+    free(grown);
+
+    char* p = NULL;
+    for (int i = 1; i <= 100000; i++) {
+        p = (char*) realloc(p, i);
+        assert(p != NULL);
+        p[i - 1] = (char) i;
+    }
+    for (int i = 1; i <= 100000; i++) {
+        assert(p[i - 1] == (char) i);
+    }
+    p = (char*) realloc(p, 100);
+    assert(p != NULL);
+    for (int i = 1; i <= 100; i++) {
+        assert(p[i - 1] == (char) i);
+    }
+    printf("EXPECTED LEAK: %p with size 100\n", p);
+    m61_printstatistics();
+    m61_printleakreport();
+}
+
+//! EXPECTED LEAK: ??{0x\w*}=pointer?? with size 100
+//! malloc count: active          1   total     100003   fail          0
+//! malloc size:  active        100   total 5000050144   fail          0
+//! LEAK CHECK: test???.c:23: allocated object ??pointer?? with size 100
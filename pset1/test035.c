@@ -0,0 +1,21 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Large calloc comes back zeroed, also after a large block was freed.
+
+int main() {
+    for (int i = 0; i < 10; i++) {
+        char* p = (char*) calloc(1 << 20, 1);
+        assert(p != NULL);
+        for (int j = 0; j < (1 << 20); j += 4096) {
+            assert(p[j] == 0);
+        }
+        memset(p, 'x', 1 << 20);
+        free(p);
+    }
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total         10   fail          0
+//! malloc size:  active          0   total   10485760   fail          0
@@ -0,0 +1,30 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Leaks aggregated by call stack, through an allocation wrapper.
+
+char* buildstring_new(size_t size) {
+    return (char*) malloc(size);
+}
+
+int main() {
+    m61_set_stack_depth(4);
+    char* label = buildstring_new(16);
+    char* buffers[2];
+    volatile int n = 2;
+    for (int i = 0; i < n; i++) {
+        buffers[i] = buildstring_new(100);
+    }
+    assert(label && buffers[0] && buffers[1]);
+    free(buildstring_new(16));
+    m61_printleakreport();
+}
+
+//! LEAK CHECK: test???.c:8: allocated object ??? with size 16
+//! LEAK CHECK: test???.c:8: allocated object ??? with size 100
+//! LEAK CHECK: test???.c:8: allocated object ??? with size 100
+//! LEAK CHECK: stack ???: 2 objects and 200 bytes leaked
+//! ???
+//! LEAK CHECK: stack ???: 1 objects and 16 bytes leaked
+//! ???
@@ -0,0 +1,38 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+// Allocator events recorded into a trace ring file.
+
+int main() {
+    int ok = m61_set_trace_file("out/test037.trace", 4);
+    assert(ok);
+    char* p = (char*) malloc(10);
+    char* q = (char*) malloc(20);
+    free(p);
+    q = (char*) realloc(q, 24);
+    free(q);
+
+    int fd = open("out/test037.trace", O_RDONLY);
+    assert(fd >= 0);
+    size_t size = sizeof(struct m61_trace_header) + 4 * sizeof(struct m61_trace_record);
+    struct m61_trace_header* header = (struct m61_trace_header*) mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    assert(header != MAP_FAILED && header->magic == M61_TRACE_MAGIC);
+    struct m61_trace_record* records = (struct m61_trace_record*) (header + 1);
+
+    printf("%llu records\n", header->count);
+    for (unsigned long long i = header->count - header->capacity; i < header->count; i++) {
+        struct m61_trace_record* r = &records[i % header->capacity];
+        printf("op %u size %llu%s\n", r->op, r->size,
+               r->op == M61_TRACE_REALLOC && r->old_pointer == r->pointer ? " in place" : "");
+    }
+}
+
+//! 5 records
+//! op 1 size 20
+//! op 2 size 0
+//! op 3 size 24 in place
+//! op 2 size 0
@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Per-site size and lifetime histograms, dumped as JSON.
+
+int main() {
+    m61_set_site_histograms(1);
+    char* kept[4];
+    for (int i = 0; i < 4; i++) {
+        kept[i] = (char*) malloc(100);
+    }
+    for (int i = 0; i < 8; i++) {
+        free(malloc(i + 1));
+    }
+    for (int i = 0; i < 4; i++) {
+        free(kept[i]);
+    }
+    m61_print_site_histograms(stdout);
+}
+
+//! {"sites": [
+//!   {"file": "test038.c", "line": 11, "allocs": 4, "bytes": 400, "frees": 4, "sizes": [[64, 4]], "lifetimes": [[8, 4]]},
+//!   {"file": "test038.c", "line": 14, "allocs": 8, "bytes": 36, "frees": 8, "sizes": [[1, 1], [2, 2], [4, 4], [8, 1]], "lifetimes": [[0, 8]]}
+//! ]}
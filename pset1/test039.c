@@ -0,0 +1,36 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+// Statistics published to the shared-memory segment.
+
+int main() {
+    void* ptrs[3];
+    for (int i = 0; i < 3; i++) {
+        ptrs[i] = malloc(100);
+    }
+    int ok = m61_set_shm_export(1);
+    assert(ok);
+
+    char name[32];
+    snprintf(name, sizeof(name), "/m61.%d", (int) getpid());
+    int fd = shm_open(name, O_RDONLY, 0);
+    assert(fd >= 0);
+    struct m61_shm* segment = (struct m61_shm*) mmap(NULL, sizeof(struct m61_shm), PROT_READ, MAP_SHARED, fd, 0);
+    assert(segment != MAP_FAILED && segment->magic == M61_SHM_MAGIC);
+    assert(segment->pid == getpid() && segment->seq % 2 == 0);
+    printf("active %llu objects, %llu bytes\n", segment->stats.nactive, segment->stats.active_size);
+    printf("hottest site line %d\n", segment->sites[0].line);
+
+    for (int i = 0; i < 3; i++) {
+        free(ptrs[i]);
+    }
+    m61_set_shm_export(0);
+    assert(shm_open(name, O_RDONLY, 0) < 0);
+}
+
+//! active 3 objects, 300 bytes
+//! hottest site line 13
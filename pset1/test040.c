@@ -0,0 +1,42 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Arena scopes: bump allocation through malloc, mark/rewind and destroy.
+
+int main() {
+    struct m61_arena* arena = m61_arena_create();
+    assert(arena != NULL);
+    char* outside = (char*) malloc(10);
+
+    struct m61_arena* previous = m61_set_current_arena(arena);
+    assert(previous == NULL);
+    char* a = (char*) malloc(100);
+    struct m61_arena_mark mark = m61_arena_mark(arena);
+    for (int i = 0; i < 1000; i++) {
+        char* p = (char*) calloc(1, 200);
+        assert(p != NULL && p[199] == 0);
+        memset(p, 'x', 200);
+    }
+    free(a);
+    m61_printstatistics();
+
+    m61_arena_rewind(arena, mark);
+    char* b = (char*) malloc(100);
+    assert(b != NULL);
+    m61_set_current_arena(NULL);
+    m61_printstatistics();
+
+    m61_arena_destroy(arena);
+    free(outside);
+    m61_printstatistics();
+}
+
+//! malloc count: active          1   total          1   fail          0
+//! malloc size:  active         10   total         10   fail          0
+//! arena size:   active     200100   reserved   262144
+//! malloc count: active          1   total          1   fail          0
+//! malloc size:  active         10   total         10   fail          0
+//! arena size:   active        200   reserved    65536
+//! malloc count: active          0   total          1   fail          0
+//! malloc size:  active          0   total         10   fail          0
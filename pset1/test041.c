@@ -0,0 +1,18 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+// Invalid free of memory mapped by the program between two heap mappings.
+
+int main() {
+    void* before = malloc(1 << 20);
+    char* mapped = (char*) mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void* after = malloc(1 << 20);
+    assert(before && mapped != MAP_FAILED && after);
+    memset(mapped, 0, 4096);
+    free(mapped + 64);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, not in heap
+//! ???
@@ -0,0 +1,32 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+// Pool objects: cache-line alignment, recycling, statistics and leak report.
+
+struct command {
+    char name[40];
+    int argc;
+    int flags;
+};
+
+int main() {
+    struct m61_pool* pool = m61_pool_create(sizeof(struct command));
+    assert(pool != NULL);
+    struct command* c[3000];
+    for (int i = 0; i < 3000; i++) {
+        c[i] = (struct command*) m61_pool_alloc(pool, __FILE__, __LINE__);
+        assert(c[i] != NULL && (uintptr_t) c[i] % 64 == 0);
+        memset(c[i], 0, sizeof(struct command));
+    }
+    for (int i = 1; i < 3000; i++) {
+        m61_pool_free(pool, c[i], __FILE__, __LINE__);
+    }
+    m61_printstatistics();
+    m61_printleakreport();
+}
+
+//! malloc count: active          1   total       3000   fail          0
+//! malloc size:  active         48   total     144000   fail          0
+//! LEAK CHECK: test???.c:19: allocated object ??{0x\w+}=ptr?? with size 48
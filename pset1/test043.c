@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+// Double free of a pool object.
+
+int main() {
+    struct m61_pool* pool = m61_pool_create(100);
+    void* ptr = m61_pool_alloc(pool, __FILE__, __LINE__);
+    m61_pool_free(pool, ptr, __FILE__, __LINE__);
+    m61_pool_free(pool, ptr, __FILE__, __LINE__);
+    m61_printstatistics();
+}
+
+//! MEMORY BUG???: invalid free of pointer ???
+//! ???
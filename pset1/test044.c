@@ -0,0 +1,24 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Footprint report: reserved and metadata bytes, internal waste per class.
+
+int main() {
+    m61_set_footprint_report(1);
+    char* p[10000];
+    for (int i = 0; i < 10000; i++) {
+        p[i] = (char*) malloc(20);
+        memset(p[i], 0, 20);
+    }
+    for (int i = 0; i < 10000; i++) {
+        free(p[i]);
+    }
+    m61_printstatistics();
+}
+
+//! malloc count: active          0   total      10000   fail          0
+//! malloc size:  active          0   total     200000   fail          0
+//! footprint:    reserved ??{[1-9]\d*}??   metadata ??{[1-9]\d*}??   quarantined      81900
+//! slab memory:  carved       800000   free         472400   fragmentation 59.0%
+//!   class     80: slots     4095   waste         40950   free     472400
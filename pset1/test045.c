@@ -0,0 +1,25 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Leak report aggregated by site, sorted by bytes, with a top-K cutoff.
+
+int main() {
+    m61_set_leak_report_sites(2);
+    for (int i = 0; i < 1000; i++) {
+        malloc(10);
+        char* b = (char*) malloc(100);
+        char* c = (char*) realloc(NULL, 30);
+        char* d = (char*) malloc(1);
+        if (i % 2 == 0) {
+            free(b);
+        }
+        c = (char*) realloc(c, 60);
+        free(d);
+    }
+    m61_printleakreport();
+}
+
+//! LEAK CHECK: site test???.c:17: 1000 objects, 60000 bytes
+//! LEAK CHECK: site test???.c:11: 500 objects, 50000 bytes
+//! LEAK CHECK: 1 more sites: 1000 objects, 10000 bytes
@@ -0,0 +1,31 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+// Destroying a pool with live objects, then allocating again.
+
+int main() {
+    struct m61_pool* pool = m61_pool_create(100);
+    char* a = (char*) m61_pool_alloc(pool, __FILE__, __LINE__);
+    char* b = (char*) m61_pool_alloc(pool, __FILE__, __LINE__);
+    m61_pool_free(pool, b, __FILE__, __LINE__);
+    m61_pool_destroy(pool);
+
+    //The live object's address may be reused, so it leaves the node index
+    printf("%s\n", m61_find_node_with_closest_pointer(a) == NULL ? "forgotten" : "still indexed");
+
+    struct m61_pool* other = m61_pool_create(300);
+    char* c = (char*) m61_pool_alloc(other, __FILE__, __LINE__);
+    assert(c != NULL);
+    m61_pool_free(other, c, __FILE__, __LINE__);
+    m61_pool_destroy(other);
+
+    printf("EXPECTED LEAK: %p with size 100\n", a);
+    m61_printstatistics();
+    m61_printleakreport();
+}
+
+//! forgotten
+//! EXPECTED LEAK: ??{0x\w*}=pointer?? with size 100
+//! malloc count: active          1   total          3   fail          0
+//! malloc size:  active        100   total        500   fail          0
+//! LEAK CHECK: test???.c:8: allocated object ??pointer?? with size 100
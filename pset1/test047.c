@@ -0,0 +1,20 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+// Freeing an arena block released by a rewind.
+
+int main() {
+    struct m61_arena* arena = m61_arena_create();
+    assert(arena != NULL);
+    m61_set_current_arena(arena);
+    struct m61_arena_mark mark = m61_arena_mark(arena);
+    char* a = (char*) malloc(100);
+    char* b = (char*) malloc(100);
+    free(b);
+    m61_arena_rewind(arena, mark);
+    m61_set_current_arena(NULL);
+    free(a);
+}
+
+//! MEMORY BUG???: invalid free of pointer ???, not allocated
+//! ???
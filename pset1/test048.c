@@ -0,0 +1,20 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Double free of a block whose header was restored after the first free.
+
+int main() {
+    char* p = (char*) malloc(50);
+    char saved[M61_HEADER_SIZE];
+    memcpy(saved, p - M61_HEADER_SIZE, M61_HEADER_SIZE);
+    free(p);
+    memcpy(p - M61_HEADER_SIZE, saved, M61_HEADER_SIZE);
+    free(p);
+    char* q = (char*) malloc(50);
+    char* r = (char*) malloc(50);
+    printf("%s\n", q == r ? "same block twice" : "different blocks");
+}
+
+//! MEMORY BUG???: invalid free of pointer ???
+//! ???
@@ -0,0 +1,15 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+// Double free of an arena block.
+
+int main() {
+    struct m61_arena* arena = m61_arena_create();
+    assert(arena != NULL);
+    char* a = (char*) m61_arena_alloc(arena, 100, __FILE__, __LINE__);
+    free(a);
+    free(a);
+}
+
+//! MEMORY BUG???: invalid free of pointer ??{0x\w+}??
+//! ???
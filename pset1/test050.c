@@ -0,0 +1,26 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <stdint.h>
+// Over-aligned blocks are counted and reported with their requested size.
+
+int main() {
+    char* p = (char*) m61_memalign(256, 100, __FILE__, __LINE__);
+    char* q = (char*) m61_memalign(4096, 10, __FILE__, __LINE__);
+    assert(((uintptr_t) p & 255) == 0 && ((uintptr_t) q & 4095) == 0);
+    free(q);
+    printf("EXPECTED LEAK: %p with size 100\n", p);
+    m61_printstatistics();
+    m61_printleakreport();
+    printf("FREE AGAIN: %p\n", q);
+    fflush(stdout);
+    free(q);
+}
+
+//! EXPECTED LEAK: ??{0x\w*}=pointer?? with size 100
+//! malloc count: active          1   total          2   fail          0
+//! malloc size:  active        100   total        110   fail          0
+//! LEAK CHECK: test???.c:8: allocated object ??pointer?? with size 100
+//! FREE AGAIN: ??{0x\w*}=q??
+//! MEMORY BUG???: invalid free of pointer ??q??
+//! ???
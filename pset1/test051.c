@@ -0,0 +1,18 @@
+#include "m61.h"
+#include <stdio.h>
+#include <assert.h>
+#include <string.h>
+// Heavy hitter report counts reallocs resized in place.
+
+int main() {
+    char* p = (char*) malloc(20);
+    for (int i = 0; i < 1000; ++i)
+        p = (char*) realloc(p, 21 + i % 4);
+    free(p);
+    for (int i = 0; i < 100; ++i)
+        free(malloc(10));
+    m61_print_hh_report();
+}
+
+//! HEAVY HITTER: test???.c:10: 22500 bytes (~95.7%), error <= 0
+//! HEAVY HITTER: test???.c:10: 1000 allocations (~90.8%), error <= 0
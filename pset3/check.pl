@@ -679,4 +679,19 @@ run(25,
     "piped large file, 1B-4KB block I/O, sequential");
 
 
+# SEEKS BETWEEN WRITES
+
+run(26,
+    "./seekcat61 -b 7000 files/text1meg.txt > files/out.txt",
+    "regular small file, 7000B block I/O, seek after every block");
+
+run(27,
+    "cat files/text1meg.txt | ./seekcat61 -b 6 | cat > files/out.txt",
+    "piped small file, 6B block I/O, failed seek after every block");
+
+run(28,
+    "./ostridecat61 -t 1024 files/text1meg.txt > files/out.txt",
+    "regular small file, character I/O, 1KB output stride order");
+
+
 summary();
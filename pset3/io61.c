@@ -6,6 +6,10 @@
 
 #define MAX_CACHE_SIZE 7000
 
+#define IO61_SLOTS 16
+#define IO61_SLOT_SIZE 4096
+#define IO61_WORD_BITS ((int) sizeof(unsigned long) * 8)
+
 #define ACCESS_SEQ 1
 #define ACCESS_RAND 2
 
@@ -14,10 +18,29 @@
 
 
 // io61.c
-// Custom IO implementation using single-block cache and in-memory mapping as caching techniques.
+// Custom IO implementation using a single-block cache for sequential access
+// and a multi-slot block cache for random access.
+
+// io61_slot
+//    One block of the random-access cache: IO61_SLOT_SIZE bytes of the file
+//    starting at an aligned file offset. Bytes [start, end) of the block are valid:
+//      - read-only files fill the whole block (start = 0, end < IO61_SLOT_SIZE only at end of file)
+//      - write-only files can't be read back, so [start, end) only bounds the bytes written
+//        since the slot was last flushed, and a bitmap tells which ones they are; a flush
+//        writes each run of written bytes, so strided writes that meet coalesce
+struct io61_slot {
+    char buf[IO61_SLOT_SIZE];
+    unsigned long written[IO61_SLOT_SIZE / IO61_WORD_BITS];    // write-only files: bit set for each written byte
+
+    off_t offset;       // file offset of buf[0], or -1 if the slot is empty
+    int start;
+    int end;
+    int dirty;          // TRUE if [start, end) was written and not yet flushed
+    int referenced;     // CLOCK reference bit
+};
 
 // io61_filedata
-//    Data structure that contains cached data (via array of bytes OR mapped file but never both),
+//    Data structure that contains cached data (via array of bytes OR cache slots but never both),
 //    and cache indexes, such as:
 //      - cache size: total amount of slots available for caching
 //      - cache index: current valid position in cache
@@ -25,44 +48,49 @@
 //                     Sequencial access is set by default, when caller opens the file using io61_open, 
 //                     and do io61_read or io61_writes without changing the cursor position using io61_seek.
 //
-//                     If the io61_seek function gets called, access_mode changes to random, in which case the
-//                     opened file is mmaped into memory (mmap) to allow reads/writes for scatter and reverse. 
+//                     If the io61_seek function gets called, access_mode changes to random, in which case
+//                     reads/writes go through IO61_SLOTS cache slots keyed by aligned file offset, using
+//                     pread/pwrite at the cursor position. When every slot is taken, CLOCK eviction picks
+//                     a victim (writing it back if dirty): the hand skips, and clears, referenced slots.
 //
-//                     By using mmap, I don't assume anything about how the file will be accessed by caller.
-//                     Otherwise I would have to control caches before and after cursor, have side cases for
-//                     end or beginning of file (for reverse), and would have to implement multiple cache blocks
-//                     for scatter access, and fine-tune the cache block size at each call, which is possible but 
-//                     resulted in a much slower implementation. 
-//                     (30% slower using multi-blocks cache then single cache block and mmap)
+//                     Memory stays bounded whatever the file size, and patterns that revisit a few
+//                     blocks (reverse, strides, reorder) hit the cache instead of making system calls.
 //                     
 struct io61_filedata {
 
     char buf[MAX_CACHE_SIZE];
-    char* map;
     
     int cache_size;
     int cache_index;
     int access_mode;
+
+    struct io61_slot slots[IO61_SLOTS];
+    int clock_hand;     // next eviction candidate
+    int recent;         // slot of the last access, checked first
 };
 
 // io61_file
 //    Data structure for io61 file wrappers.
-//    I added file size, cursor_position and a struct containing cache information.
+//    I added cursor_position and a struct containing cache information.
 struct io61_file {
     int fd;
 
     int mode;
-    int size;
-    int cursor_pos;
+    off_t cursor_pos;
     
     struct io61_filedata filedata;
 };
 
-ssize_t io61_read_mapped(io61_file* f, char* buf, size_t sz);
+ssize_t io61_read_slots(io61_file* f, char* buf, size_t sz);
 ssize_t io61_read_cached_block(io61_file* f, char* buf, size_t sz);
  
 ssize_t io61_write_cached_block(io61_file* f, const char* buf, size_t sz);
-ssize_t io61_write_mapped(io61_file* f, const char* buf, size_t sz);
+ssize_t io61_write_slots(io61_file* f, const char* buf, size_t sz);
+
+struct io61_slot* io61_find_slot(io61_file* f, off_t offset);
+int io61_flush_slot(io61_file* f, struct io61_slot* slot);
+void io61_mark_written(struct io61_slot* slot, int index, int n);
+int io61_find_written(struct io61_slot* slot, int index, int end, int written);
 
 // io61_fdopen(fd, mode)
 //    Return a new io61_file that reads from and/or writes to the given
@@ -76,10 +104,23 @@ io61_file* io61_fdopen(int fd, int mode) {
     f->fd = fd;
     (void) mode;
     f->mode = mode;
-    f->size = io61_filesize(f);
+    f->cursor_pos = 0;
     
     //Sets sequencial access as default for reads/writes.
     f->filedata.access_mode = ACCESS_SEQ;
+    f->filedata.cache_size = 0;
+    f->filedata.cache_index = 0;
+
+    //Cache slots start empty
+    for (int i = 0; i < IO61_SLOTS; i++) {
+        f->filedata.slots[i].offset = -1;
+        f->filedata.slots[i].start = f->filedata.slots[i].end = 0;
+        memset(f->filedata.slots[i].written, 0, sizeof(f->filedata.slots[i].written));
+        f->filedata.slots[i].dirty = FALSE;
+        f->filedata.slots[i].referenced = FALSE;
+    }
+    f->filedata.clock_hand = 0;
+    f->filedata.recent = 0;
     return f;
 }
 
@@ -105,15 +146,15 @@ int io61_readc(io61_file* f) {
     struct io61_filedata * filedata = &f->filedata;
 
     // To improve speed, try to read from cache (if there is any)...
-    if (filedata->cache_index + 1 < filedata->cache_size ) {
+    if (filedata->access_mode == ACCESS_SEQ && filedata->cache_index + 1 < filedata->cache_size ) {
         //casting to unsigned char to avoid 'EOF' characters in binary file
         return (unsigned char)filedata->buf[filedata->cache_index++];
     }
     // ... otherwise, calls io61_read to populate and read from cache
     else{
-        char * buf = (char*) malloc(sizeof(int));
-        if (io61_read(f, buf, 1) == 1)
-            return (unsigned char)buf[0];
+        char ch;
+        if (io61_read(f, &ch, 1) == 1)
+            return (unsigned char)ch;
         else
             return EOF;
     }
@@ -130,9 +171,9 @@ ssize_t io61_read(io61_file* f, char* buf, size_t sz) {
     // If access mode = Sequencial, use cache blocks
     if (f->filedata.access_mode == ACCESS_SEQ){
         return io61_read_cached_block(f, buf, sz);
-    // If access mode = Random, use memory mapped file
+    // If access mode = Random, use cache slots
     } else {
-        return io61_read_mapped(f, buf, sz);
+        return io61_read_slots(f, buf, sz);
     }
 }
 
@@ -177,27 +218,156 @@ ssize_t io61_read_cached_block(io61_file* f, char* buf, size_t sz) {
         return -1;
 }
 
-// io61_read_mapped(f, buf, sz)
-//    This method implements read with cached file in-memory for random access reads.
-//
-//    First time this method is called, it maps the file into memory using 'mmap' (lazy loading technique) 
-//    All subsequent calls will copy 'sz' bytes from in-memory file into 'buf' and return number of copied bytes.
-//
-//    NOTE: There is a limitation for mmap for files as large as 20MB, but since it simplifies the caching
-//    for reverse and scatter reads, I overlooked this problem as explained above.
-//
-ssize_t io61_read_mapped(io61_file* f, char* buf, size_t sz) {
+// io61_find_slot(f, offset)
+//    Returns the cache slot holding the block at 'offset' (a multiple of IO61_SLOT_SIZE).
+//    On a miss, CLOCK picks a victim: the hand clears the reference bit of each referenced
+//    slot it passes and stops at the first empty or unreferenced one. The victim is flushed
+//    if dirty, and for read-only files refilled from the block with pread.
+//    Returns NULL if the flush or the read failed.
+
+struct io61_slot* io61_find_slot(io61_file* f, off_t offset) {
 
     struct io61_filedata * fdata = &f->filedata;
-    
-    // Will load the file into virtual memory once per file
-    if (fdata->map == NULL) {
-        int nbytes_to_read = f->size > 0 ? f->size : MAX_CACHE_SIZE;
-        fdata->map = mmap(NULL, nbytes_to_read, PROT_READ, MAP_PRIVATE, f->fd, 0);
+
+    // Consecutive accesses mostly hit the same block, so the last slot is checked first
+    struct io61_slot * slot = &fdata->slots[fdata->recent];
+    if (slot->offset == offset) {
+        slot->referenced = TRUE;
+        return slot;
+    }
+    for (int i = 0; i < IO61_SLOTS; i++) {
+        if (fdata->slots[i].offset == offset) {
+            fdata->recent = i;
+            fdata->slots[i].referenced = TRUE;
+            return &fdata->slots[i];
+        }
+    }
+
+    // Miss: sweeps the clock hand until an empty or unreferenced slot comes up
+    slot = &fdata->slots[fdata->clock_hand];
+    while (slot->offset >= 0 && slot->referenced) {
+        slot->referenced = FALSE;
+        fdata->clock_hand = (fdata->clock_hand + 1) % IO61_SLOTS;
+        slot = &fdata->slots[fdata->clock_hand];
+    }
+    int index = fdata->clock_hand;
+    fdata->clock_hand = (fdata->clock_hand + 1) % IO61_SLOTS;
+
+    if (io61_flush_slot(f, slot) < 0)
+        return NULL;
+    slot->offset = offset;
+    slot->start = slot->end = 0;
+    slot->referenced = TRUE;
+
+    // Read-only files load the whole block; write-only ones start with no valid bytes
+    if (f->mode == O_RDONLY) {
+        ssize_t nread = pread(f->fd, slot->buf, IO61_SLOT_SIZE, offset);
+        if (nread < 0) {
+            slot->offset = -1;
+            return NULL;
+        }
+        slot->end = nread;
+    }
+    fdata->recent = index;
+    return slot;
+}
+
+// io61_flush_slot(f, slot)
+//    Writes the dirty bytes of a cache slot to the file at their offset, one pwrite per run
+//    of written bytes: the gaps between runs hold nothing the file doesn't already have.
+//    After the flush a write-only slot holds no valid bytes, so the next write may land anywhere in it.
+//    Returns 0 on success or -1 on error.
+
+int io61_flush_slot(io61_file* f, struct io61_slot* slot) {
+
+    if (slot->dirty) {
+        int index = slot->start;
+        while (index < slot->end) {
+            // Skips the gap up to the next written byte, then finds where its run ends
+            index = io61_find_written(slot, index, slot->end, TRUE);
+            int run_end = io61_find_written(slot, index, slot->end, FALSE);
+
+            while (index < run_end) {
+                ssize_t nwritten = pwrite(f->fd, &slot->buf[index], run_end - index, slot->offset + index);
+                if (nwritten <= 0)
+                    return -1;
+                index += nwritten;
+            }
+        }
+        slot->dirty = FALSE;
+    }
+    if (f->mode != O_RDONLY) {
+        memset(slot->written, 0, sizeof(slot->written));
+        slot->start = slot->end = 0;
+    }
+    return 0;
+}
+
+// io61_mark_written(slot, index, n)
+//    Sets the bits of bytes [index, index + n) of a write-only slot in its bitmap,
+//    a word at a time.
+
+void io61_mark_written(struct io61_slot* slot, int index, int n) {
+    int end = index + n;
+    while (index < end) {
+        int bit = index % IO61_WORD_BITS;
+        int count = IO61_WORD_BITS - bit < end - index ? IO61_WORD_BITS - bit : end - index;
+        unsigned long mask = (count == IO61_WORD_BITS ? ~0UL : (1UL << count) - 1) << bit;
+        slot->written[index / IO61_WORD_BITS] |= mask;
+        index += count;
     }
-    // Copies 'sz' bytes from file, begining at cursor position
-    memcpy(buf, &fdata->map[f->cursor_pos], sz);
-    return sz;
+}
+
+// io61_find_written(slot, index, end, written)
+//    Returns the first byte in [index, end) of a write-only slot whose bitmap bit is set
+//    (written = TRUE) or clear (written = FALSE), or 'end' if there is none.
+//    Whole words are skipped at once, so sparse slots flush quickly.
+
+int io61_find_written(struct io61_slot* slot, int index, int end, int written) {
+    while (index < end) {
+        unsigned long word = slot->written[index / IO61_WORD_BITS];
+        if (!written)
+            word = ~word;
+        word &= ~0UL << (index % IO61_WORD_BITS);
+        if (word != 0) {
+            int found = index - index % IO61_WORD_BITS + __builtin_ctzl(word);
+            return found < end ? found : end;
+        }
+        index += IO61_WORD_BITS - index % IO61_WORD_BITS;
+    }
+    return end;
+}
+
+// io61_read_slots(f, buf, sz)
+//    This method implements random access reads through the cache slots.
+//    Copies 'sz' bytes from the slots holding the blocks at the cursor position into 'buf',
+//    loading blocks as needed, and advances the cursor.
+//    Returns the number of copied bytes (short at end of file), or -1 if an error occurred
+//    before any byte was read.
+
+ssize_t io61_read_slots(io61_file* f, char* buf, size_t sz) {
+
+    size_t nread = 0;
+
+    while (nread < sz) {
+        off_t offset = f->cursor_pos & ~(off_t) (IO61_SLOT_SIZE - 1);
+        struct io61_slot * slot = io61_find_slot(f, offset);
+        if (slot == NULL)
+            return nread ? (ssize_t) nread : -1;
+
+        // A block shorter than the cursor position means end of file
+        int index = f->cursor_pos - offset;
+        if (index >= slot->end)
+            break;
+
+        size_t n = slot->end - index;
+        if (n > sz - nread)
+            n = sz - nread;
+        memcpy(buf + nread, &slot->buf[index], n);
+        nread += n;
+        f->cursor_pos += n;
+    }
+    return nread;
 }
 
 // io61_writec(f)
@@ -209,15 +379,14 @@ int io61_writec(io61_file* f, int ch) {
     struct io61_filedata * fdata = &f->filedata;
     
     // To improve speed, try to write to cache (if slots are available)...
-    if (fdata->cache_index + 1 < fdata->cache_size){
+    if (fdata->access_mode == ACCESS_SEQ && fdata->cache_index + 1 < fdata->cache_size){
         fdata->buf[fdata->cache_index++] = ch;
         return 0;
     }
     // ... otherwise, calls io61_write to write to cache block or IO
     else {
-        char * buf = (char*) malloc(sizeof(int));
-        buf[0] = ch;
-        if (io61_write(f, buf, 1) == 1)
+        char c = ch;
+        if (io61_write(f, &c, 1) == 1)
             return 0;
         else
             return -1;
@@ -230,7 +399,7 @@ int io61_writec(io61_file* f, int ch) {
 //    an error occurred before any characters were written.
 //    
 //    NOTE: similar to rio61_read, can either write to single-block cache if access mode = Sequencial,
-//    or write to in-memory mapped file if access mode = Random.
+//    or write to cache slots if access mode = Random.
 
 ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
     struct io61_filedata * fdata = &f->filedata;
@@ -238,9 +407,9 @@ ssize_t io61_write(io61_file* f, const char* buf, size_t sz) {
     // If access mode = Sequencial, use cache blocks
     if (fdata->access_mode == ACCESS_SEQ){
         return io61_write_cached_block(f, buf, sz);
-    // If access mode = Random, use memory mapped file
+    // If access mode = Random, use cache slots
     } else {
-        return io61_write_mapped(f, buf, sz);
+        return io61_write_slots(f, buf, sz);
     }
 }
 
@@ -292,14 +461,41 @@ ssize_t io61_write_cached_block(io61_file* f, const char* buf, size_t sz) {
         return -1;
 }
 
-//io61_write_mapped(f, buf, sz)
-//   Write 'sz' bytes from 'buf' to file 'f' and return number of written files
-//   TO IMPROVE: making direct write IO calls without buffering
-ssize_t io61_write_mapped(io61_file* f, const char* buf, size_t sz) {
+// io61_write_slots(f, buf, sz)
+//    This method implements random access writes through the cache slots.
+//    Copies 'sz' bytes from 'buf' into the slots of the blocks at the cursor position and
+//    advances the cursor; dirty slots reach the file when evicted or flushed.
+//    Writes may leave gaps in a slot: the bitmap records which bytes were written.
+//    Returns the number of written bytes, or -1 if an error occurred before any byte was written.
+
+ssize_t io61_write_slots(io61_file* f, const char* buf, size_t sz) {
 
-    lseek(f->fd, f->cursor_pos, SEEK_SET);
-    write(f->fd, buf, sz);
-    return sz;
+    size_t nwritten = 0;
+
+    while (nwritten < sz) {
+        off_t offset = f->cursor_pos & ~(off_t) (IO61_SLOT_SIZE - 1);
+        struct io61_slot * slot = io61_find_slot(f, offset);
+        if (slot == NULL)
+            return nwritten ? (ssize_t) nwritten : -1;
+
+        int index = f->cursor_pos - offset;
+        int n = IO61_SLOT_SIZE - index;
+        if ((size_t) n > sz - nwritten)
+            n = sz - nwritten;
+        memcpy(&slot->buf[index], buf + nwritten, n);
+        io61_mark_written(slot, index, n);
+        if (slot->end == slot->start) {
+            slot->start = index;
+            slot->end = index + n;
+        } else {
+            slot->start = index < slot->start ? index : slot->start;
+            slot->end = index + n > slot->end ? index + n : slot->end;
+        }
+        slot->dirty = TRUE;
+        nwritten += n;
+        f->cursor_pos += n;
+    }
+    return nwritten;
 }
 
 // io61_flush(f)
@@ -314,15 +510,22 @@ int io61_flush(io61_file* f) {
     // If mode = Write ...
     if (f->mode == O_WRONLY){
         // ... and access mode = Sequential, flushes cached blocks to disk
+        // and empties the cache block, so nothing gets written twice
         if (fdata->access_mode == ACCESS_SEQ){
-            int remaining = 0;
-            if ((remaining = fdata->cache_size - fdata->cache_index)) {
-                write(f->fd, &fdata->buf, fdata->cache_index);
-                fdata->cache_index = fdata->cache_size;
+            int index = 0;
+            while (index < fdata->cache_index) {
+                ssize_t nwritten = write(f->fd, &fdata->buf[index], fdata->cache_index - index);
+                if (nwritten <= 0)
+                    return -1;
+                index += nwritten;
             }
-        // ... If access mode = Random, syncs the in-memory file to physical file
+            fdata->cache_index = fdata->cache_size = 0;
+        // ... If access mode = Random, writes dirty cache slots back to disk
         } else {
-            msync(fdata->map, f->size, MS_SYNC);
+            for (int i = 0; i < IO61_SLOTS; i++) {
+                if (io61_flush_slot(f, &fdata->slots[i]) < 0)
+                    return -1;
+            }
         }
     }
     
@@ -336,9 +539,20 @@ int io61_flush(io61_file* f) {
 //
 //    Also, sets the access mode = Random, because most likely the caller will
 //    write / read arbitrary positions on the file, in which case the caching strategy
-//    will use in-memory file mapping (mmap).
+//    will use cache slots keyed by file offset.
 int io61_seek(io61_file* f, off_t pos) {
     struct io61_filedata * fdata = &f->filedata;
+
+    // Slots read and write at explicit offsets, so in random mode a seek is just a cursor move
+    if (fdata->access_mode == ACCESS_RAND){
+        if (pos < 0)
+            return -1;
+        f->cursor_pos = pos;
+        return 0;
+    }
+
+    // Bytes buffered by sequential writes go out before switching modes
+    io61_flush(f);
     off_t r = lseek(f->fd, (off_t) pos, SEEK_SET);
     
     if (r == (off_t) pos){
@@ -347,8 +561,8 @@ int io61_seek(io61_file* f, off_t pos) {
         return 0;
     }
     else{
-        // Special case: non-seekable files such as /dev/urandom cannot be 'mmapped',
-        // therefore cache block is mandatory
+        // Special case: non-seekable files such as pipes have no offsets to key
+        // cache slots by, therefore cache block is mandatory
         fdata->access_mode = ACCESS_SEQ;
         return -1;
     }
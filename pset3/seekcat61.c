@@ -0,0 +1,40 @@
+#include "io61.h"
+
+// Usage: ./seekcat61 [-b BLOCKSIZE] [FILE]
+//    Copies the input FILE to standard output in blocks, seeking standard
+//    output to its current position after every block. The seeks fail on
+//    pipes, which must leave the output unchanged. Default BLOCKSIZE is 4096.
+
+int main(int argc, char** argv) {
+    // Parse arguments
+    size_t blocksize = 4096;
+    if (argc >= 3 && strcmp(argv[1], "-b") == 0) {
+        blocksize = strtoul(argv[2], 0, 0);
+        argc -= 2, argv += 2;
+    }
+
+    // Allocate buffer, open files
+    assert(blocksize > 0);
+    char* buf = (char*) malloc(blocksize);
+
+    const char* in_filename = argc >= 2 ? argv[1] : NULL;
+    io61_profile_begin();
+    io61_file* inf = io61_open_check(in_filename, O_RDONLY);
+    io61_file* outf = io61_fdopen(STDOUT_FILENO, O_WRONLY);
+
+    // Copy file data
+    off_t pos = 0;
+    while (1) {
+        ssize_t amount = io61_read(inf, buf, blocksize);
+        if (amount <= 0)
+            break;
+        io61_write(outf, buf, amount);
+        pos += amount;
+        io61_seek(outf, pos);
+    }
+
+    io61_close(inf);
+    io61_close(outf);
+    io61_profile_end();
+    free(buf);
+}